@@ -0,0 +1,423 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "astio.h"
+#include "astree.h"
+#include "auxlib.h"
+#include "lyutils.h"
+#include "stringset.h"
+
+// Nothing the compiler writes comes near this, so a larger count
+// means the data is bad.
+static const long MAX_CHILDREN = 1 << 20;
+
+// The stack of the parser keeps it from building deeper trees, and
+// the passes that recurse over a tree rely on that.
+static const int MAX_DEPTH = 10000;
+
+void astio_put_int (string* out, long value) {
+   uint32_t word = value;
+   for (int byte = 0; byte < 4; ++byte) {
+      out->push_back ((char) (word >> (8 * byte)));
+   }
+}
+
+void astio_put_string (string* out, const string& text) {
+   astio_put_int (out, text.size());
+   out->append (text);
+}
+
+void astio_put_tree (string* out, astree* tree) {
+   astio_put_int (out, tree->symbol);
+   astio_put_int (out, tree->filenr);
+   astio_put_int (out, tree->linenr);
+   astio_put_int (out, tree->offset);
+   astio_put_string (out, *tree->lexinfo);
+   astio_put_int (out, tree->children.size());
+   for (size_t child = 0; child < tree->children.size(); ++child) {
+      astio_put_tree (out, tree->children[child]);
+   }
+}
+
+long astio_get_int (astio_reader* in) {
+   if (in->failed or in->end - in->pos < 4) {
+      in->failed = true;
+      return 0;
+   }
+   uint32_t word = 0;
+   for (int byte = 0; byte < 4; ++byte) {
+      word |= (uint32_t) (unsigned char) in->pos[byte] << (8 * byte);
+   }
+   in->pos += 4;
+   return (int32_t) word;
+}
+
+string astio_get_string (astio_reader* in) {
+   long size = astio_get_int (in);
+   if (in->failed or size < 0 or in->end - in->pos < size) {
+      in->failed = true;
+      return "";
+   }
+   string text (in->pos, size);
+   in->pos += size;
+   return text;
+}
+
+/*
+ * Tells whether child index of tree is there and has symbol.
+ */
+static bool child_is (const astree* tree, size_t index, int symbol) {
+   return index < tree->children.size()
+       and tree->children[index]->symbol == symbol;
+}
+
+/*
+ * Tells whether tree has the children the parser gives a node of its
+ * kind, as far as the type checker and the oil generator index them
+ * without looking.  The children are checked on their own.  The
+ * parser adopts the arguments of a call after the first into the
+ * first, so an expression may have more children than its kind.
+ */
+static bool well_formed (const astree* tree) {
+   size_t count = tree->children.size();
+   switch (tree->symbol) {
+   case ROOT: case TOK_BLOCK: case TOK_PARAMLIST:
+      return true;
+   case TOK_CALL:
+      return child_is (tree, 0, IDENT);
+   case TOK_STRUCT:
+      return count <= 2 and child_is (tree, 0, TOK_TYPEID)
+          and (count == 1 or child_is (tree, 1, TOK_PARAMLIST));
+   case TOK_TYPE:
+      return count <= 2
+          and (child_is (tree, 0, TOK_BASETYPE)
+               or child_is (tree, 0, TOK_ARRAY))
+          and (count == 1 or child_is (tree, 1, TOK_DECLID));
+   case TOK_ARRAY:
+      return count == 1 and child_is (tree, 0, TOK_BASETYPE);
+   case TOK_NEWARRAY:
+      return count >= 2 and child_is (tree, 0, TOK_BASETYPE);
+   case TOK_FUNCTION:
+      return (count == 3 or child_is (tree, 2, TOK_PARAMLIST))
+          and count <= 4 and child_is (tree, count - 1, TOK_BLOCK)
+          and child_is (tree, 0, TOK_TYPE)
+          and child_is (tree, 1, TOK_DECLID);
+   case TOK_PROTOTYPE:
+      return count <= 3 and child_is (tree, 0, TOK_TYPE)
+          and child_is (tree, 1, TOK_DECLID)
+          and (count == 2 or child_is (tree, 2, TOK_PARAMLIST));
+   case TOK_VARDECL:
+      return count <= 3 and child_is (tree, 0, TOK_TYPE)
+          and child_is (tree, 1, TOK_DECLID);
+   case '.':
+      return count == 2 and child_is (tree, 1, TOK_FIELD);
+   case TOK_ALLOCATOR:
+      return child_is (tree, 0, TOK_TYPEID);
+   case TOK_UNOP:
+      return count >= 1 and tree->children[0]->children.size() == 1;
+   case TOK_BINOP:
+      return count >= 3;
+   case TOK_VARIABLE: case TOK_CONSTANT: case TOK_NEWSTRING:
+      return count >= 1;
+   case TOK_IFELSE:
+      return count == 3;
+   case TOK_WHILE: case TOK_IF: case TOK_INDEX:
+      return count == 2;
+   case TOK_BASETYPE: case TOK_RETURN: case TOK_POS: case TOK_NEG:
+   case '!': case TOK_ORD: case TOK_CHR:
+      return count == 1;
+   default:
+      return count == 0;
+   }
+}
+
+/*
+ * Reads a tree at depth below the root of the whole tree.
+ */
+static astree* get_tree (astio_reader* in, int depth) {
+   int symbol = astio_get_int (in);
+   int filenr = astio_get_int (in);
+   int linenr = astio_get_int (in);
+   int offset = astio_get_int (in);
+   string lexinfo = astio_get_string (in);
+   long nchildren = astio_get_int (in);
+   if (in->failed or not is_defined_token (symbol) or filenr < 0
+         or nchildren < 0 or nchildren > MAX_CHILDREN
+         or (nchildren > 0 and depth >= MAX_DEPTH)) {
+      in->failed = true;
+      return NULL;
+   }
+   astree* tree = new_astree (symbol, filenr, linenr, offset,
+         lexinfo.c_str());
+   for (long child = 0; child < nchildren; ++child) {
+      astree* subtree = get_tree (in, depth + 1);
+      if (subtree == NULL) {
+         free_ast (tree);
+         return NULL;
+      }
+      tree->children.push_back (subtree);
+   }
+   if (not well_formed (tree)) {
+      free_ast (tree);
+      in->failed = true;
+      return NULL;
+   }
+   return tree;
+}
+
+astree* astio_get_tree (astio_reader* in) {
+   return get_tree (in, 0);
+}
+
+/*
+ * Returns the index of text in the string table, adding it if it
+ * is not there yet.
+ */
+static uint32_t string_index (const string& text,
+      map<string,uint32_t>* index, vector<const string*>* table) {
+   map<string,uint32_t>::iterator found = index->find (text);
+   if (found != index->end()) return found->second;
+   uint32_t added = table->size();
+   index->insert (make_pair (text, added));
+   table->push_back (&text);
+   return added;
+}
+
+static void write_padding (FILE* out, size_t* offset, size_t align) {
+   while (*offset % align != 0) {
+      fputc ('\0', out);
+      ++*offset;
+   }
+}
+
+void astio_write_file (FILE* out, astree* root,
+      const vector<string>& interned,
+      const vector<string>& filenames) {
+   map<string,uint32_t> index;
+   vector<const string*> table;
+   for (size_t text = 0; text < interned.size(); ++text) {
+      string_index (interned[text], &index, &table);
+   }
+   uint32_t ninterned = table.size();
+   vector<uint32_t> files;
+   for (size_t file = 0; file < filenames.size(); ++file) {
+      files.push_back (string_index (filenames[file], &index,
+            &table));
+   }
+
+   // Breadth first, so that the children of each node are adjacent.
+   vector<astree*> order (1, root);
+   vector<astb_node> nodes;
+   for (size_t next = 0; next < order.size(); ++next) {
+      astree* tree = order[next];
+      astb_node node;
+      node.symbol = tree->symbol;
+      node.filenr = tree->filenr;
+      node.linenr = tree->linenr;
+      node.offset = tree->offset;
+      node.lexinfo = string_index (*tree->lexinfo, &index, &table);
+      node.first_child = order.size();
+      node.nchildren = tree->children.size();
+      node.reserved = 0;
+      nodes.push_back (node);
+      order.insert (order.end(), tree->children.begin(),
+            tree->children.end());
+   }
+
+   vector<uint32_t> offsets (1, 0);
+   for (size_t text = 0; text < table.size(); ++text) {
+      offsets.push_back (offsets.back() + table[text]->size() + 1);
+   }
+   astb_header header;
+   memset (&header, 0, sizeof header);
+   strcpy (header.magic, ASTB_MAGIC);
+   header.byte_order = ASTB_BYTE_ORDER;
+   header.nstrings = table.size();
+   header.ninterned = ninterned;
+   header.nfiles = files.size();
+   header.nnodes = nodes.size();
+   size_t offset = sizeof header;
+   header.string_offsets = offset;
+   offset += offsets.size() * sizeof (uint32_t);
+   header.string_data = offset;
+   offset += offsets.back();
+   offset = (offset + 3) & ~3;
+   header.files = offset;
+   offset += files.size() * sizeof (uint32_t);
+   offset = (offset + 7) & ~7;
+   header.nodes = offset;
+   header.size = offset + nodes.size() * sizeof (astb_node);
+
+   fwrite (&header, sizeof header, 1, out);
+   fwrite (offsets.data(), sizeof (uint32_t), offsets.size(), out);
+   offset = header.string_data;
+   for (size_t text = 0; text < table.size(); ++text) {
+      fwrite (table[text]->c_str(), 1, table[text]->size() + 1, out);
+   }
+   offset += offsets.back();
+   write_padding (out, &offset, 4);
+   fwrite (files.data(), sizeof (uint32_t), files.size(), out);
+   offset += files.size() * sizeof (uint32_t);
+   write_padding (out, &offset, 8);
+   fwrite (nodes.data(), sizeof (astb_node), nodes.size(), out);
+}
+
+/*
+ * Tells whether count items of size bytes at offset lie inside a
+ * file of file_size bytes and are aligned to align.
+ */
+static bool in_file (size_t file_size, size_t offset, size_t count,
+      size_t size, size_t align) {
+   return offset % align == 0 and offset <= file_size
+       and count <= (file_size - offset) / size;
+}
+
+/*
+ * Checks everything astio_load_file relies on, so that a damaged
+ * file cannot make it read outside the mapping or build anything
+ * but a tree.  Returns a description of the first problem, or NULL.
+ */
+static const char* check_astb (const char* base, size_t file_size) {
+   if (file_size < sizeof (astb_header)) return "file too short";
+   const astb_header* header = (const astb_header*) base;
+   if (memcmp (header->magic, ASTB_MAGIC, sizeof ASTB_MAGIC) != 0) {
+      return "not an .astb file";
+   }
+   if (header->byte_order != ASTB_BYTE_ORDER) {
+      return "written with another byte order";
+   }
+   if (header->size != file_size) return "wrong size";
+   if (header->ninterned > header->nstrings
+         or header->nstrings >= UINT32_MAX
+         or not in_file (file_size, header->string_offsets,
+               header->nstrings + 1, sizeof (uint32_t), 4)
+         or not in_file (file_size, header->files, header->nfiles,
+               sizeof (uint32_t), 4)
+         or not in_file (file_size, header->nodes, header->nnodes,
+               sizeof (astb_node), 8)
+         or header->nnodes == 0) {
+      return "bad section";
+   }
+
+   const uint32_t* offsets =
+         (const uint32_t*) (base + header->string_offsets);
+   const char* data = base + header->string_data;
+   if (offsets[0] != 0 or header->string_data > file_size
+         or offsets[header->nstrings]
+            > file_size - header->string_data) {
+      return "bad string table";
+   }
+   for (uint32_t text = 0; text < header->nstrings; ++text) {
+      if (offsets[text + 1] <= offsets[text]
+            or offsets[text + 1] > offsets[header->nstrings]
+            or data[offsets[text + 1] - 1] != '\0') {
+         return "bad string table";
+      }
+   }
+   const uint32_t* files = (const uint32_t*) (base + header->files);
+   for (uint32_t file = 0; file < header->nfiles; ++file) {
+      if (files[file] >= header->nstrings) return "bad file name";
+   }
+
+   // Each node but the root is the child of exactly one node before
+   // it, which makes the nodes a tree.
+   const astb_node* nodes = (const astb_node*) (base + header->nodes);
+   uint64_t next_child = 1;
+   for (uint32_t node = 0; node < header->nnodes; ++node) {
+      if (nodes[node].lexinfo >= header->nstrings
+            or nodes[node].filenr >= header->nfiles
+            or nodes[node].first_child != next_child
+            or not is_defined_token (nodes[node].symbol)) {
+         return "bad node";
+      }
+      next_child += nodes[node].nchildren;
+   }
+   if (next_child != header->nnodes) return "bad node";
+
+   // In breadth-first order, the depth of a node is known before
+   // its children are reached.
+   vector<int> depth (header->nnodes, 0);
+   for (uint32_t node = 0; node < header->nnodes; ++node) {
+      for (uint32_t child = 0; child < nodes[node].nchildren;
+            ++child) {
+         depth[nodes[node].first_child + child] = depth[node] + 1;
+      }
+      if (nodes[node].nchildren > 0 and depth[node] >= MAX_DEPTH) {
+         return "tree too deep";
+      }
+   }
+   return NULL;
+}
+
+astree* astio_load_file (const string& path,
+      vector<string>* filenames) {
+   int fd = open (path.c_str(), O_RDONLY | O_CLOEXEC);
+   struct stat info;
+   if (fd < 0 or fstat (fd, &info) != 0) {
+      syserrprintf (path.c_str());
+      if (fd >= 0) close (fd);
+      return NULL;
+   }
+   size_t file_size = info.st_size;
+   void* mapping = file_size == 0 ? MAP_FAILED
+         : mmap (NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close (fd);
+   if (mapping == MAP_FAILED and file_size > 0) {
+      syserrprintf (path.c_str());
+      return NULL;
+   }
+   const char* problem = mapping == MAP_FAILED ? "file too short"
+         : check_astb ((const char*) mapping, file_size);
+   if (problem != NULL) {
+      errprintf ("%:%s: %s\n", path.c_str(), problem);
+      if (mapping != MAP_FAILED) munmap (mapping, file_size);
+      return NULL;
+   }
+
+   const char* base = (const char*) mapping;
+   const astb_header* header = (const astb_header*) base;
+   const uint32_t* offsets =
+         (const uint32_t*) (base + header->string_offsets);
+   const char* data = base + header->string_data;
+   const uint32_t* files = (const uint32_t*) (base + header->files);
+   const astb_node* nodes = (const astb_node*) (base + header->nodes);
+
+   for (uint32_t text = 0; text < header->ninterned; ++text) {
+      intern_stringset (data + offsets[text]);
+   }
+   for (uint32_t file = 0; file < header->nfiles; ++file) {
+      filenames->push_back (data + offsets[files[file]]);
+   }
+   vector<astree*> trees;
+   for (uint32_t node = 0; node < header->nnodes; ++node) {
+      const astb_node& entry = nodes[node];
+      trees.push_back (new_astree (entry.symbol, entry.filenr,
+            entry.linenr, entry.offset, data + offsets[entry.lexinfo]));
+   }
+   for (uint32_t node = 0; node < header->nnodes; ++node) {
+      uint32_t first = nodes[node].first_child;
+      trees[node]->children.assign (trees.begin() + first,
+            trees.begin() + first + nodes[node].nchildren);
+   }
+   munmap (mapping, file_size);
+   for (size_t node = 0; node < trees.size(); ++node) {
+      if (not well_formed (trees[node])) {
+         errprintf ("%:%s: bad node\n", path.c_str());
+         free_ast (trees[0]);
+         return NULL;
+      }
+   }
+   return trees[0];
+}
@@ -0,0 +1,128 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __ASTIO_H__
+#define __ASTIO_H__
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "symtable.h"
+
+//
+// DESCRIPTION
+//    Binary form of abstract syntax trees, for the trees the compiler
+//    saves and later loads instead of parsing the text again.  Numbers
+//    are stored as 32 bit little endian words, strings as their
+//    length followed by their bytes, and a tree in preorder, each
+//    node as its symbol, position, lexical information and number of
+//    children.  Reading never trusts the data: a short or malformed
+//    buffer, a symbol that is no token of the parser, a node without
+//    the children of its kind or a tree deeper than the parser
+//    builds makes the reader fail instead of crashing.
+//
+
+struct astio_reader {
+   const char* pos;
+   const char* end;
+   bool failed;
+   astio_reader (const char* data, size_t size):
+         pos (data), end (data + size), failed (false) {}
+};
+
+void astio_put_int (string* out, long value);
+void astio_put_string (string* out, const string& text);
+void astio_put_tree (string* out, astree* tree);
+   //
+   // Append a number, a string or a whole tree to out.
+   //
+
+long astio_get_int (astio_reader* in);
+string astio_get_string (astio_reader* in);
+   //
+   // Read a number or a string.  Return 0 or "" and mark the reader
+   // as failed if there is not enough data.
+   //
+
+astree* astio_get_tree (astio_reader* in);
+   //
+   // Reads a tree, making its nodes with new_astree, so that their
+   // lexical information is interned in the current compilation.
+   // Returns NULL and marks the reader as failed on bad data.
+   //
+
+//
+// DESCRIPTION
+//    The .astb file, a parsed program that can be mapped into memory
+//    and used in place, by the compiler instead of running cpp, the
+//    scanner and the parser, or by other tools.  All numbers are in
+//    the byte order of the machine that wrote the file, which
+//    byte_order tells.  The file is an astb_header followed by:
+//
+//    string_offsets  uint32_t[nstrings + 1], where string i is at
+//                    string_data + string_offsets[i] and ends with a
+//                    NUL before string_offsets[i + 1].  The first
+//                    ninterned strings are the string set of the
+//                    compilation in the order it was filled.
+//    string_data     The bytes of the strings.
+//    files           uint32_t[nfiles], the strings that name the
+//                    files cpp included, indexed by node filenr.
+//    nodes           astb_node[nnodes] in breadth-first order, so
+//                    that the children of a node are the nodes
+//                    first_child up to first_child + nchildren, and
+//                    the root is node 0.
+//
+//    Offsets are from the start of the file and multiples of 4, and
+//    nodes is a multiple of 8.
+//
+
+#define ASTB_MAGIC "OCASTB1"
+static const uint32_t ASTB_BYTE_ORDER = 0x01020304;
+
+struct astb_header {
+   char magic[8];             // ASTB_MAGIC and a NUL
+   uint32_t byte_order;       // ASTB_BYTE_ORDER as written
+   uint32_t size;             // Of the whole file
+   uint32_t nstrings;
+   uint32_t ninterned;
+   uint32_t nfiles;
+   uint32_t nnodes;
+   uint32_t string_offsets;
+   uint32_t string_data;
+   uint32_t files;
+   uint32_t nodes;
+};
+
+struct astb_node {
+   int32_t symbol;            // Token code of the parser
+   uint32_t filenr;           // Index into files
+   uint32_t linenr;
+   uint32_t offset;
+   uint32_t lexinfo;          // Index into the strings
+   uint32_t first_child;      // Index into nodes
+   uint32_t nchildren;
+   uint32_t reserved;         // 0
+};
+
+void astio_write_file (FILE* out, astree* root,
+      const vector<string>& interned,
+      const vector<string>& filenames);
+   //
+   // Writes root as a .astb file.  interned is the string set of the
+   // compilation in the order it was filled, and filenames the files
+   // the node filenr fields index.
+   //
+
+astree* astio_load_file (const string& path,
+      vector<string>* filenames);
+   //
+   // Maps the .astb file path, interns its strings in order, adds
+   // its file names to *filenames and returns its tree.  Reports
+   // the problem and returns NULL if the file is not a valid .astb.
+   //
+
+#endif
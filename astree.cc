@@ -10,6 +10,7 @@
 #include "astree.h"
 #include "stringset.h"
 #include "lyutils.h"
+#include "trace.h"
 
 static const size_t FN_WITH_PARAM = 4;
 static const size_t STRUCT_WITH_PARAM = 2;
@@ -23,17 +24,13 @@ astree* new_astree (int symbol, int filenr, int linenr,
    tree->linenr = linenr;
    tree->offset = offset;
    tree->lexinfo = intern_stringset (lexinfo);
-   DEBUGF ('f', "astree %p->{%d:%d.%d: %s: \"%s\"}\n",
-         tree, tree->filenr, tree->linenr, tree->offset,
-         get_yytname (tree->symbol), tree->lexinfo->c_str());
+   TRACE (TRACE_AST, EVENT_NEW_ASTREE, tree, symbol, linenr);
    return tree;
 }
 
 astree* adopt1 (astree* root, astree* child) {
    root->children.push_back (child);
-   DEBUGF ('a', "%p (%s) adopting %p (%s)\n",
-         root, root->lexinfo->c_str(),
-         child, child->lexinfo->c_str());
+   TRACE (TRACE_AST, EVENT_ADOPT, root, child, 0);
    return root;
 }
 
@@ -215,9 +212,7 @@ void free_ast (astree* root) {
       root->children.pop_back();
       free_ast (child);
    }
-   DEBUGF ('f', "free [%p]-> %d:%d.%d: %s: \"%s\")\n",
-         root, root->filenr, root->linenr, root->offset,
-         get_yytname (root->symbol), root->lexinfo->c_str());
+   TRACE (TRACE_AST, EVENT_FREE_AST, root, root->symbol, 0);
    delete root;
 }
 
@@ -354,7 +349,7 @@ static void traverse_ast_rec (SymbolTable *table, SymbolTable *types,
       string lexinfo = insert_sym->lexinfo->c_str();
 
       table = table->enterFunction (lexinfo, param, insert_sym);
-      root->blockNum = table->N - 1;
+      root->blockNum = table->getNumber();
       if (cmp_func) {
          add_param_sym (table, root, FN_WITH_PARAM);
       } else {
@@ -369,7 +364,7 @@ static void traverse_ast_rec (SymbolTable *table, SymbolTable *types,
       table->addSymbol (lexinfo, type, insert_sym);
    } else if (cmp_while || cmp_if || cmp_ifelse) {
       table = table->enterBlock();
-      root->blockNum = table->N - 1;
+      root->blockNum = table->getNumber();
    } else if (cmp_struct) {
       insert_sym = root->children[0];
       string lexinfo = insert_sym->lexinfo->c_str();
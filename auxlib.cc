@@ -12,7 +12,7 @@
 
 #include "auxlib.h"
 
-static int exitstatus = EXIT_SUCCESS;
+static thread_local int exitstatus = EXIT_SUCCESS;
 static const char* execname = NULL;
 static const char* debugflags = "";
 static bool alldebugflags = false;
@@ -94,6 +94,10 @@ void set_exitstatus (int newexitstatus) {
    DEBUGF ('x', "exitstatus = %d\n", exitstatus);
 }
 
+void reset_exitstatus (void) {
+   exitstatus = EXIT_SUCCESS;
+}
+
 void __stubprintf (const char* file, int line, const char* func,
                    const char* format, ...) {
    va_list args;
@@ -108,7 +112,7 @@ void __stubprintf (const char* file, int line, const char* func,
 
 void set_debugflags (const char* flags) {
    debugflags = flags;
-   if (strchr (debugflags, '@') != NULL) alldebugflags = true;
+   alldebugflags = strchr (debugflags, '@') != NULL;
    DEBUGF ('x', "Debugflags = \"%s\", all = %d\n",
            debugflags, alldebugflags);
 }
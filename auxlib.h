@@ -43,6 +43,13 @@ void set_exitstatus (int);
    // Sets the exit status.  Remebers only the largest value passed in.
    //
 
+void reset_exitstatus (void);
+   //
+   // Resets the exit status to EXIT_SUCCESS.  The exit status is kept
+   // per thread, so that compilations running concurrently do not
+   // see each other's errors.
+   //
+
 
 void veprintf (const char* format, va_list args);
    //
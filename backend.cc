@@ -0,0 +1,293 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "auxlib.h"
+#include "backend.h"
+
+extern char** environ;
+
+/*
+ * Runtime objects compiled by runtime_object_for, keyed by the real
+ * path of the source, whether it was built for the collector and
+ * the level it was optimized at.  Each object has a name of its
+ * own, so that rebuilding one never overwrites another.
+ */
+struct runtime_object {
+   string object;
+   string stamp;              // file_stamp of source and oclib.oh
+};
+static mutex runtime_lock;
+static map<string,runtime_object> runtime_objects;
+static string runtime_dir;
+static unsigned long runtime_serial = 0;
+
+static pid_t spawn (const char** argv, int stdin_fd) {
+   posix_spawn_file_actions_t actions;
+   posix_spawn_file_actions_init (&actions);
+   if (stdin_fd >= 0) {
+      posix_spawn_file_actions_adddup2 (&actions, stdin_fd,
+            STDIN_FILENO);
+   }
+   pid_t pid;
+   int rc = posix_spawnp (&pid, argv[0], &actions, NULL,
+         (char**) argv, environ);
+   posix_spawn_file_actions_destroy (&actions);
+   if (rc != 0) {
+      errno = rc;
+      syserrprintf (argv[0]);
+      return -1;
+   }
+   return pid;
+}
+
+/*
+ * Returns the modification time and size of path, which change with
+ * its contents, or "" if it has none.
+ */
+static string file_stamp (const string& path) {
+   struct stat info;
+   if (stat (path.c_str(), &info) != 0) return "";
+   return to_string (info.st_mtim.tv_sec) + "."
+        + to_string (info.st_mtim.tv_nsec) + " "
+        + to_string (info.st_size);
+}
+
+/*
+ * Returns an object file compiled from source, building it first if
+ * there is none yet or the source or the oclib.oh next to it, which
+ * every runtime source includes, changed since.  Falls back to the
+ * source itself if that fails, so gcc reports the problem.
+ */
+static string runtime_object_for (const string& source,
+      const compile_options* options) {
+   char* real = realpath (source.c_str(), NULL);
+   if (real == NULL) return source;
+   string path = real;
+   free (real);
+   string stamp = file_stamp (path);
+   if (stamp.empty()) return source;
+   stamp += " " + file_stamp (path.substr (0, path.find_last_of ('/'))
+                              + "/oclib.oh");
+   string key = path + (options->use_gc ? " gc" : "");
+   if (not options->optimize.empty()) key += " " + options->optimize;
+
+   lock_guard<mutex> guard (runtime_lock);
+   map<string,runtime_object>::iterator found =
+         runtime_objects.find (key);
+   if (found != runtime_objects.end()
+         and found->second.stamp == stamp) {
+      return found->second.object;
+   }
+
+   if (runtime_dir.empty()) {
+      char dir[] = "/tmp/ocrt.XXXXXX";
+      if (mkdtemp (dir) == NULL) {
+         syserrprintf ("mkdtemp");
+         return source;
+      }
+      runtime_dir = dir;
+   }
+   string object = runtime_dir + "/" + to_string (runtime_serial++)
+                 + ".o";
+   vector<const char*> argv = {"gcc", "-g", "-c", "-o", object.c_str(),
+         source.c_str()};
+   if (options->use_gc) argv.push_back ("-DOCLIB_GC");
+   if (not options->optimize.empty()) {
+      argv.push_back (options->optimize.c_str());
+   }
+   argv.push_back (NULL);
+   pid_t pid = spawn (argv.data(), -1);
+   if (pid < 0) return source;
+   int status = backend_wait (pid, NULL);
+   if (status != 0) {
+      eprint_status ("gcc", status);
+      return source;
+   }
+   DEBUGF ('m', "runtime %s built as %s\n", key.c_str(),
+         object.c_str());
+
+   // The object it replaces is out of date; a link that has it open
+   // still reads it.
+   runtime_object& entry = runtime_objects[key];
+   if (not entry.object.empty()) unlink (entry.object.c_str());
+   entry.object = object;
+   entry.stamp = stamp;
+   return object;
+}
+
+void backend_cleanup (void) {
+   lock_guard<mutex> guard (runtime_lock);
+   map<string,runtime_object>::iterator entry;
+   for (entry = runtime_objects.begin();
+         entry != runtime_objects.end(); ++entry) {
+      unlink (entry->second.object.c_str());
+   }
+   runtime_objects.clear();
+   if (not runtime_dir.empty()) rmdir (runtime_dir.c_str());
+   runtime_dir.clear();
+}
+
+void backend_runtime_sources (const compile_options* options,
+      vector<string>* sources) {
+   sources->push_back ("oclib.c");
+   if (options->use_gc) sources->push_back ("ocgc.c");
+}
+
+/*
+ * Appends the runtime the program links with to argv, as sources or
+ * as the objects built once for options->cache_runtime.
+ */
+static void add_runtime (const compile_options* options,
+      vector<string>* runtime) {
+   backend_runtime_sources (options, runtime);
+   if (options->cache_runtime) {
+      for (size_t index = 0; index < runtime->size(); ++index) {
+         (*runtime)[index] = runtime_object_for ((*runtime)[index],
+               options);
+      }
+   }
+}
+
+/*
+ * Starts gcc with argv and stores a stream to its stdin in *in.
+ */
+static pid_t spawn_gcc (vector<const char*>& argv, FILE** in) {
+   // Both ends are close-on-exec so that no other child holds the
+   // write end open and keeps gcc from seeing end of file.
+   int fds[2];
+   if (pipe2 (fds, O_CLOEXEC) < 0) {
+      syserrprintf ("pipe");
+      return -1;
+   }
+   argv.push_back (NULL);
+   pid_t pid = spawn (argv.data(), fds[0]);
+   close (fds[0]);
+   if (pid < 0) {
+      close (fds[1]);
+      return -1;
+   }
+   DEBUGF ('m', "gcc pid = %d, pipe fd = %d\n", pid, fds[1]);
+   *in = fdopen (fds[1], "w");
+   return pid;
+}
+
+pid_t backend_spawn (const string& prog_name,
+      const compile_options* options, FILE** oil_pipe) {
+   vector<string> runtime;
+   string output = prog_name;
+   if (options->compile_only) {
+      output += ".o";
+   } else {
+      add_runtime (options, &runtime);
+   }
+
+   // The oil is C from stdin; "-x none" lets gcc tell the runtime
+   // sources from objects by their suffix again.
+   vector<const char*> argv = {"gcc", "-g", "-o", output.c_str(),
+         "-x", "c", "-", "-x", "none"};
+   if (options->compile_only) argv.push_back ("-c");
+   if (options->use_gc) argv.push_back ("-DOCLIB_GC");
+   if (not options->optimize.empty()) {
+      argv.push_back (options->optimize.c_str());
+   }
+   for (size_t index = 0; index < runtime.size(); ++index) {
+      argv.push_back (runtime[index].c_str());
+   }
+   return spawn_gcc (argv, oil_pipe);
+}
+
+int backend_link (const string& output, const vector<string>& objects,
+      const vector<string>& inits, const compile_options* options,
+      struct rusage* usage) {
+   vector<string> runtime;
+   add_runtime (options, &runtime);
+   vector<const char*> argv = {"gcc", "-g", "-o", output.c_str(),
+         "-x", "c", "-", "-x", "none"};
+   if (options->use_gc) argv.push_back ("-DOCLIB_GC");
+   if (not options->optimize.empty()) {
+      argv.push_back (options->optimize.c_str());
+   }
+   for (size_t index = 0; index < objects.size(); ++index) {
+      argv.push_back (objects[index].c_str());
+   }
+   for (size_t index = 0; index < runtime.size(); ++index) {
+      argv.push_back (runtime[index].c_str());
+   }
+
+   FILE* stub = NULL;
+   pid_t pid = spawn_gcc (argv, &stub);
+   if (pid < 0) return -1;
+
+   // The runtime calls __ocmain, which runs the statements of every
+   // module in the order given.
+   for (size_t index = 0; index < inits.size(); ++index) {
+      fprintf (stub, "void %s (void);\n", inits[index].c_str());
+   }
+   fprintf (stub, "void __ocmain (void) {\n");
+   for (size_t index = 0; index < inits.size(); ++index) {
+      fprintf (stub, "   %s ();\n", inits[index].c_str());
+   }
+   fprintf (stub, "}\n");
+   fclose (stub);
+   return backend_wait (pid, usage);
+}
+
+int backend_wait (pid_t pid, struct rusage* usage) {
+   int status = 0;
+   struct rusage ignored;
+   if (usage == NULL) usage = &ignored;
+   while (wait4 (pid, &status, 0, usage) < 0) {
+      if (errno != EINTR) {
+         syserrprintf ("wait4");
+         return -1;
+      }
+   }
+   return status;
+}
+
+/*
+ * Cookie functions for the stream returned by tee_open.
+ */
+struct tee_cookie {
+   FILE* first;
+   FILE* second;
+};
+
+static ssize_t tee_write (void* cookie, const char* buf, size_t size) {
+   tee_cookie* tee = (tee_cookie*) cookie;
+   if (fwrite (buf, 1, size, tee->first) != size) return -1;
+   if (fwrite (buf, 1, size, tee->second) != size) return -1;
+   return size;
+}
+
+static int tee_close (void* cookie) {
+   tee_cookie* tee = (tee_cookie*) cookie;
+   int rc = fclose (tee->first);
+   if (fclose (tee->second) != 0) rc = EOF;
+   delete tee;
+   return rc;
+}
+
+FILE* tee_open (FILE* first, FILE* second) {
+   tee_cookie* tee = new tee_cookie();
+   tee->first = first;
+   tee->second = second;
+   cookie_io_functions_t functions = {NULL, tee_write, NULL, tee_close};
+   return fopencookie (tee, "w", functions);
+}
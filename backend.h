@@ -0,0 +1,77 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "context.h"
+
+//
+// DESCRIPTION
+//    Runs gcc as the back end of the compiler.  The generated oil is
+//    streamed into gcc's stdin through a pipe, so gcc can start
+//    compiling while the front end is still finishing its work.
+//
+
+pid_t backend_spawn (const string& prog_name,
+      const compile_options* options, FILE** oil_pipe);
+   //
+   // Starts "gcc -g -o prog_name -x c - oclib.c" with its stdin
+   // connected to a pipe.  With options->use_gc, the program is
+   // linked against the garbage-collected runtime in ocgc.c as well.
+   // With options->cache_runtime, the runtime is compiled to objects
+   // once and those are linked in by every later call.  With
+   // options->compile_only, gcc writes the object prog_name.o of a
+   // module instead and links nothing.  With options->optimize, gcc
+   // optimizes at that level; the hints of options->profile_use only
+   // matter then.
+   // Stores the write end of the pipe in *oil_pipe and returns the
+   // pid of gcc, or -1 on failure.  Closing *oil_pipe signals end
+   // of input to gcc.
+   //
+
+int backend_link (const string& output, const vector<string>& objects,
+      const vector<string>& inits, const compile_options* options,
+      struct rusage* usage);
+   //
+   // Links the module objects and the runtime into the program
+   // output.  inits names the function of each module that runs its
+   // statements, called in order from the generated __ocmain.  The
+   // runtime is built as for backend_spawn.
+   // Returns the status of gcc as reported by waitpid(2), or -1, and
+   // stores its resource usage in *usage.
+   //
+
+void backend_runtime_sources (const compile_options* options,
+      vector<string>* sources);
+   //
+   // Appends the sources of the runtime a program is linked with to
+   // *sources.
+   //
+
+void backend_cleanup (void);
+   //
+   // Removes the runtime objects built for options->cache_runtime.
+   //
+
+int backend_wait (pid_t pid, struct rusage* usage);
+   //
+   // Waits for the back end, or any other child, to finish and
+   // returns the status as reported by waitpid(2).  If usage is not
+   // NULL, the resource usage of the child is stored in *usage.
+   //
+
+FILE* tee_open (FILE* first, FILE* second);
+   //
+   // Returns a stream that copies everything written to it into
+   // both first and second.  Closing it closes both streams.
+   //
+
+#endif
@@ -0,0 +1,130 @@
+#!/bin/bash
+# Paul Scherer, pscherer@ucsc.edu
+#
+# NAME
+#    bench.sh - compile throughput of oc on synthetic programs
+#
+# SYNOPSIS
+#    bench.sh oc ocgen [workdir]
+#
+# DESCRIPTION
+#    Grows one dimension of the programs made by ocgen at a time,
+#    from the base size through each factor of BENCH_SCALES, and
+#    compiles each program with oc -Tjson BENCH_RUNS times, keeping
+#    the fastest wall time of each phase.  For each dimension it
+#    prints the source lines compiled per second by every phase, and
+#    the growth of each phase's time against the growth of the source
+#    over the last step, as the exponent k of time ~ bytes^k, which is
+#    near 1 for a linear phase.  Growth above BENCH_LIMIT is marked as
+#    super-linear.  Bytes rather than lines measure the source, since
+#    longer expressions make longer lines.  The points are
+#    also written to workdir/curves.csv, for plotting.
+#
+#    The base size is that of ocgen with no options.  BENCH_SCALES
+#    defaults to "1 2 4 8", BENCH_RUNS to 3 and BENCH_LIMIT to 1.25.
+#
+
+set -e
+# A hit in the cache would skip the phases being measured.
+unset OC_CACHE_DIR
+if [ $# -lt 2 ]; then
+   echo "Usage: $0 oc ocgen [workdir]" >&2
+   exit 1
+fi
+OC=$(readlink -f $1)
+OCGEN=$(readlink -f $2)
+WORK=${3:-bench/work}
+SCALES=${BENCH_SCALES:-1 2 4 8}
+RUNS=${BENCH_RUNS:-3}
+LIMIT=${BENCH_LIMIT:-1.25}
+LIBDIR=$(dirname $OC)
+
+mkdir -p $WORK
+cp $LIBDIR/oclib.c $LIBDIR/oclib.oh $WORK
+cd $WORK
+echo "dimension,value,lines,bytes,phase,wall,lines_per_second" \
+     >curves.csv
+
+# The wall time of each phase in the total of an -Tjson report.
+phase_walls() {
+   sed -n '/^ "total"/,/^ }/p' \
+   | sed -n 's/^  "\([a-z]*\)": {"wall": \([0-9.]*\).*/\1 \2/p'
+}
+
+# dimension option base
+measure() {
+   local dimension=$1 option=$2 base=$3
+   for scale in $SCALES; do
+      local value=$((base * scale))
+      $OCGEN $option $value >gen.oc
+      local lines=$(wc -l <gen.oc) bytes=$(wc -c <gen.oc)
+      for run in $(seq $RUNS); do
+         $OC -Tjson gen.oc 2>&1 >/dev/null | phase_walls
+      done | awk -v dimension=$dimension -v value=$value \
+                 -v lines=$lines -v bytes=$bytes '
+         !($1 in best) || $2 < best[$1] { best[$1] = $2 }
+         END {
+            for (phase in best) {
+               wall = best[phase]
+               printf "%s,%d,%d,%d,%s,%.6f,%.0f\n", dimension, value,
+                      lines, bytes, phase, wall,
+                      (wall > 0 ? lines / wall : 0)
+            }
+         }' >point.csv
+      cat point.csv >>curves.csv
+      cat point.csv >>$dimension.csv
+   done
+}
+
+report() {
+   local dimension=$1
+   awk -F, -v limit=$LIMIT -v dimension=$dimension '
+      BEGIN {
+         order = "cpp parse symbols typecheck oil dumps gcc"
+         nphases = split (order, phases, " ")
+      }
+      {
+         if (!($2 in seen)) { seen[$2] = 1; values[++nvalues] = $2 }
+         lines[$2] = $3; bytes[$2] = $4
+         wall[$2, $5] = $6; rate[$2, $5] = $7
+      }
+      END {
+         printf "%s:\n%8s %8s", dimension, "value", "lines"
+         for (p = 1; p <= nphases; ++p) printf " %9s", phases[p]
+         printf "\n"
+         for (v = 1; v <= nvalues; ++v) {
+            value = values[v]
+            printf "%8d %8d", value, lines[value]
+            for (p = 1; p <= nphases; ++p) {
+               printf " %9d", rate[value, phases[p]]
+            }
+            printf "\n"
+         }
+         if (nvalues < 2) exit
+         last = values[nvalues]; prev = values[nvalues - 1]
+         printf "%17s", "growth"
+         for (p = 1; p <= nphases; ++p) {
+            phase = phases[p]
+            if (wall[prev, phase] <= 0 || wall[last, phase] <= 0) {
+               printf " %9s", "-"
+               continue
+            }
+            growth = log (wall[last, phase] / wall[prev, phase]) \
+                   / log (bytes[last] / bytes[prev])
+            printf " %8.2f%s", growth, (growth > limit ? "!" : " ")
+         }
+         printf "\n\n"
+      }' $dimension.csv
+}
+
+echo "source lines per second, and the growth of time against bytes"
+echo "of source over the last step, marked with ! above $LIMIT"
+echo
+for dimension in functions:-f:16 structs:-s:4 depth:-d:3 terms:-e:8 \
+                 strings:-t:64; do
+   IFS=: read name option base <<<"$dimension"
+   rm -f $name.csv
+   measure $name $option $base
+   report $name
+done
+rm -f gen gen.* point.csv
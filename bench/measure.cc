@@ -0,0 +1,142 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+//
+// NAME
+//    measure - run a program and report what it cost
+//
+// SYNOPSIS
+//    measure [-i input] [-o output] program [arg...]
+//
+// DESCRIPTION
+//    Runs program with its standard input and output redirected
+//    from and to the files given, and prints to the standard output
+//    one CSV line of the wall seconds it took, the instructions it
+//    retired in user mode and its peak RSS in KB.  The instructions
+//    are counted with perf_event_open(2) from the exec on, so that
+//    none of measure itself are counted.  When the kernel refuses
+//    the counter, for lack of permission or of the hardware, the
+//    instructions are given as "-".  Exits with failure if program
+//    could not be run or did not exit with status 0.
+//
+
+#include <string>
+using namespace std;
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char* program_name = "measure";
+
+static void fail (const char* what) {
+   fprintf (stderr, "%s: %s: %s\n", program_name, what,
+         strerror (errno));
+   exit (EXIT_FAILURE);
+}
+
+/*
+ * Opens a counter of the instructions of pid, which starts counting
+ * when pid calls exec.  Returns -1 if the kernel refuses.
+ */
+static int open_instructions (pid_t pid) {
+   struct perf_event_attr attr;
+   memset (&attr, 0, sizeof attr);
+   attr.size = sizeof attr;
+   attr.type = PERF_TYPE_HARDWARE;
+   attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+   attr.disabled = 1;
+   attr.enable_on_exec = 1;
+   attr.inherit = 1;
+   attr.exclude_kernel = 1;
+   attr.exclude_hv = 1;
+   attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                    | PERF_FORMAT_TOTAL_TIME_RUNNING;
+   return syscall (__NR_perf_event_open, &attr, pid, -1, -1,
+         PERF_FLAG_FD_CLOEXEC);
+}
+
+static void redirect (const char* path, int flags, int target) {
+   int fd = open (path, flags, 0666);
+   if (fd < 0) fail (path);
+   dup2 (fd, target);
+   close (fd);
+}
+
+int main (int argc, char** argv) {
+   program_name = basename (argv[0]);
+   const char* input = NULL;
+   const char* output = NULL;
+   int option;
+   while ((option = getopt (argc, argv, "+i:o:")) != EOF) {
+      switch (option) {
+         case 'i': input = optarg;  break;
+         case 'o': output = optarg; break;
+         default:
+            fprintf (stderr, "Usage: %s [-i input] [-o output]"
+                  " program [arg...]\n", program_name);
+            exit (EXIT_FAILURE);
+      }
+   }
+   if (optind >= argc) {
+      fprintf (stderr, "%s: no program\n", program_name);
+      exit (EXIT_FAILURE);
+   }
+
+   // The child waits for the counter to be opened before its exec.
+   int ready[2];
+   if (pipe (ready) < 0) fail ("pipe");
+   pid_t pid = fork();
+   if (pid < 0) fail ("fork");
+   if (pid == 0) {
+      close (ready[1]);
+      char byte;
+      if (read (ready[0], &byte, 1) < 0) _exit (127);
+      close (ready[0]);
+      if (input != NULL) redirect (input, O_RDONLY, 0);
+      if (output != NULL) {
+         redirect (output, O_WRONLY | O_CREAT | O_TRUNC, 1);
+      }
+      execvp (argv[optind], &argv[optind]);
+      fprintf (stderr, "%s: %s: %s\n", program_name, argv[optind],
+            strerror (errno));
+      _exit (127);
+   }
+   close (ready[0]);
+   int counter = open_instructions (pid);
+
+   struct timespec start;
+   struct timespec end;
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   close (ready[1]);
+   int status;
+   struct rusage usage;
+   if (wait4 (pid, &status, 0, &usage) < 0) fail ("wait4");
+   clock_gettime (CLOCK_MONOTONIC, &end);
+
+   string instructions = "-";
+   uint64_t value[3];         // Count, time enabled, time running
+   if (counter >= 0 and read (counter, value, sizeof value)
+         == sizeof value and value[2] != 0) {
+      instructions = to_string ((uint64_t)
+            (value[0] * ((double) value[1] / value[2])));
+   }
+   if (not WIFEXITED (status) or WEXITSTATUS (status) != 0) {
+      fprintf (stderr, "%s: %s: status 0x%04X\n", program_name,
+            argv[optind], status);
+      exit (EXIT_FAILURE);
+   }
+   printf ("%.6f,%s,%ld\n", (end.tv_sec - start.tv_sec)
+         + (end.tv_nsec - start.tv_nsec) / 1e9, instructions.c_str(),
+         usage.ru_maxrss);
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <string>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "auxlib.h"
+#include "micro.h"
+
+static int scan_number (const char* arg) {
+   char* end;
+   long number = strtol (arg, &end, 10);
+   if (*end != '\0' or number < 1 or number > 1000000) {
+      errprintf ("%s: bad number\n", arg);
+      exit (EXIT_FAILURE);
+   }
+   return number;
+}
+
+micro_options micro_start (int argc, char** argv) {
+   set_execname (argv[0]);
+   micro_options options;
+   int option;
+   while ((option = getopt (argc, argv, "r:s:")) != EOF) {
+      switch (option) {
+         case 'r': options.repeats = scan_number (optarg); break;
+         case 's': options.seed = scan_number (optarg);    break;
+         default:
+            eprintf ("Usage: %s [-r repeats] [-s seed]\n",
+                  get_execname());
+            exit (EXIT_FAILURE);
+      }
+   }
+   // Never freed, as the string set and the tables live as long as
+   // the benchmark.
+   static compile_options compile;
+   set_context (new compile_context ("micro.oc", &compile));
+   printf ("benchmark,case,size,ops,seconds,ns_per_op\n");
+   return options;
+}
+
+double micro_now (void) {
+   struct timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+   return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+unsigned micro_random (unsigned* state) {
+   *state = *state * 1103515245 + 12345;
+   return *state >> 16;
+}
+
+void micro_row (const char* benchmark, const string& name, long size,
+      long ops, double seconds) {
+   printf ("%s,%s,%ld,%ld,%.6f,%.2f\n", benchmark, name.c_str(), size,
+         ops, seconds, ops == 0 ? 0 : seconds * 1e9 / ops);
+   fflush (stdout);
+}
@@ -0,0 +1,68 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __MICRO_H__
+#define __MICRO_H__
+
+#include <string>
+using namespace std;
+
+#include "context.h"
+
+//
+// DESCRIPTION
+//    Shared harness of the microbenchmarks, which time the data
+//    structures of the compiler in isolation, linked with its
+//    objects.  Each case is run a number of times and the fastest
+//    run is kept.  Results go to the standard output as CSV, with the
+//    columns benchmark, case, size, ops, seconds and ns_per_op, where
+//    size is what the case varies and ops what it counts.
+//
+
+struct micro_options {
+   int repeats;               // -r: runs of each case
+   unsigned seed;             // -s: seed of the inputs
+   micro_options(): repeats (5), seed (1) {}
+};
+
+micro_options micro_start (int argc, char** argv);
+   //
+   // Scans the options of a microbenchmark, makes a compilation
+   // context for the calling thread and prints the CSV header.
+   //
+
+double micro_now (void);
+   //
+   // Returns seconds on the monotonic clock.
+   //
+
+unsigned micro_random (unsigned* state);
+   //
+   // Returns the next pseudo-random number from *state, the same on
+   // every platform.
+   //
+
+void micro_row (const char* benchmark, const string& name, long size,
+      long ops, double seconds);
+   //
+   // Prints a CSV row for a case whose fastest run took seconds.
+   //
+
+template <typename reset_fn, typename body_fn>
+double micro_best (const micro_options& options, reset_fn reset,
+      body_fn body) {
+   double best = 0;
+   for (int run = 0; run < options.repeats; ++run) {
+      reset();
+      double start = micro_now();
+      body();
+      double seconds = micro_now() - start;
+      if (run == 0 or seconds < best) best = seconds;
+   }
+   return best;
+}
+   //
+   // Runs body options.repeats times, each after an untimed call of
+   // reset, and returns the seconds of the fastest run.
+   //
+
+#endif
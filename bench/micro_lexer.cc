@@ -0,0 +1,112 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+//
+// NAME
+//    micro_lexer - time the scanner
+//
+// SYNOPSIS
+//    micro_lexer [-r repeats] [-s seed]
+//
+// DESCRIPTION
+//    Runs yylex over texts of about a megabyte in memory, read
+//    through fmemopen(3) as the compiler reads the output of cpp,
+//    and counts the tokens.  Each text is made of one kind of token,
+//    identifiers, numbers, string constants or operators, or is a
+//    real program.  The time includes what the scanner does for
+//    every token, making its node and interning its text, but not
+//    the parser.
+//
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stdio.h>
+
+#include "lyutils.h"
+#include "micro.h"
+
+static const size_t TEXT_SIZE = 1 << 20;
+
+static const char* const program =
+   "struct node {\n"
+   "   int value;\n"
+   "   node link;\n"
+   "}\n"
+   "int fib (int n) {\n"
+   "   int a = 0;\n"
+   "   int b = 1;\n"
+   "   while (n > 0) {\n"
+   "      int t = a + b;\n"
+   "      a = b;\n"
+   "      b = t;\n"
+   "      n = n - 1;\n"
+   "   }\n"
+   "   return a;\n"
+   "}\n"
+   "string[] names = new string[10];\n"
+   "names[0] = \"fib of ten\";\n"
+   "if (fib (10) != 55) puts (names[0]);\n";
+
+/*
+ * A text of kind, repeating tokens until it fills TEXT_SIZE.
+ */
+static string make_text (const string& kind, unsigned* state) {
+   static const char* const operators[] = {
+      "+", "-", "*", "/", "%", "=", "==", "!=", "<", "<=", ">", ">=",
+      "(", ")", "[", "]", "{", "}", ";", ",", ".", "!", "[]",
+   };
+   string text;
+   while (text.size() < TEXT_SIZE) {
+      if (kind == "program") {
+         text += program;
+         continue;
+      }
+      for (int column = 0; column < 10; ++column) {
+         unsigned roll = micro_random (state);
+         if (kind == "identifiers") {
+            text += "name_" + to_string (roll % 1000);
+         }else if (kind == "numbers") {
+            text += to_string (roll);
+         }else if (kind == "strings") {
+            text += "\"string constant " + to_string (roll % 1000)
+                  + "\\n\"";
+         }else {
+            text += operators[roll % 23];
+         }
+         text += ' ';
+      }
+      text += '\n';
+   }
+   return text;
+}
+
+static long scan_text (string& text) {
+   FILE* input = fmemopen ((void*) text.data(), text.size(), "r");
+   yyrestart (input);
+   long tokens = 0;
+   while (yylex() != YYEOF) {
+      free_ast (yylval);
+      ++tokens;
+   }
+   yylex_destroy();
+   fclose (input);
+   return tokens;
+}
+
+int main (int argc, char** argv) {
+   micro_options options = micro_start (argc, argv);
+   unsigned state = options.seed;
+   scanner_newfilename ("micro.oc");
+   static const char* const kinds[] = {
+      "identifiers", "numbers", "strings", "operators", "program",
+   };
+   for (int kind = 0; kind < 5; ++kind) {
+      string text = make_text (kinds[kind], &state);
+      long tokens = 0;
+      double seconds = micro_best (options, [] () {},
+            [&text, &tokens] () { tokens = scan_text (text); });
+      micro_row ("lexer", kinds[kind], text.size(), tokens, seconds);
+   }
+   return get_exitstatus();
+}
@@ -0,0 +1,117 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+//
+// NAME
+//    micro_stringset - time intern_stringset
+//
+// SYNOPSIS
+//    micro_stringset [-r repeats] [-s seed]
+//
+// DESCRIPTION
+//    Interns identifiers drawn from vocabularies of growing size.
+//    In the zipf cases the draws follow Zipf's law, as identifiers
+//    in programs do: a few names such as i or n are used all the
+//    time and most only a few times, so most calls find the string
+//    already there.  In the unique cases every string is new, which
+//    times the inserts and the rehashing of a growing set.  The set
+//    starts empty in every run.
+//
+
+#include <algorithm>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "auxlib.h"
+#include "micro.h"
+#include "stringset.h"
+
+static const long DRAWS = 1000000;
+
+/*
+ * A made-up identifier: mostly short names, some longer ones with
+ * words joined by underscores, now and then a digit.
+ */
+static string make_identifier (unsigned* state) {
+   static const char* const letters = "abcdefghijklmnopqrstuvwxyz";
+   unsigned roll = micro_random (state) % 10;
+   int length = roll < 3 ? 1 + micro_random (state) % 3
+              : roll < 8 ? 4 + micro_random (state) % 5
+              : 9 + micro_random (state) % 8;
+   string name;
+   for (int index = 0; index < length; ++index) {
+      if (index > 2 and micro_random (state) % 6 == 0) name += '_';
+      else name += letters[micro_random (state) % 26];
+   }
+   if (micro_random (state) % 8 == 0) {
+      name += '0' + micro_random (state) % 10;
+   }
+   return name;
+}
+
+static vector<string> make_vocabulary (size_t size, unsigned* state) {
+   vector<string> words;
+   words.reserve (size);
+   for (size_t count = 0; count < size; ++count) {
+      words.push_back (make_identifier (state));
+      // Equal names would only shrink the vocabulary.
+      words.back() += "_" + to_string (count);
+   }
+   return words;
+}
+
+/*
+ * Draws from words with the probability of the word of rank r in
+ * proportion to 1 / r.
+ */
+static vector<const char*> zipf_draws (const vector<string>& words,
+      long draws, unsigned* state) {
+   vector<double> cumulative;
+   double total = 0;
+   for (size_t rank = 1; rank <= words.size(); ++rank) {
+      total += 1.0 / rank;
+      cumulative.push_back (total);
+   }
+   vector<const char*> result;
+   result.reserve (draws);
+   for (long draw = 0; draw < draws; ++draw) {
+      double point = total * (micro_random (state) % 65536) / 65536;
+      size_t rank = upper_bound (cumulative.begin(), cumulative.end(),
+            point) - cumulative.begin();
+      result.push_back (words[min (rank, words.size() - 1)].c_str());
+   }
+   return result;
+}
+
+static void time_interns (const micro_options& options,
+      const string& name, long size,
+      const vector<const char*>& draws) {
+   stringset& strings = get_context()->strings;
+   double seconds = micro_best (options,
+         [&strings] () { stringset().swap (strings); },
+         [&draws] () {
+            for (size_t draw = 0; draw < draws.size(); ++draw) {
+               intern_stringset (draws[draw]);
+            }
+         });
+   micro_row ("stringset", name, size, draws.size(), seconds);
+}
+
+int main (int argc, char** argv) {
+   micro_options options = micro_start (argc, argv);
+   unsigned state = options.seed;
+   for (long size = 100; size <= 100000; size *= 10) {
+      vector<string> words = make_vocabulary (size, &state);
+      time_interns (options, "zipf", size,
+            zipf_draws (words, DRAWS, &state));
+   }
+   for (long size = 10000; size <= 1000000; size *= 10) {
+      vector<string> words = make_vocabulary (size, &state);
+      vector<const char*> draws;
+      for (long index = 0; index < size; ++index) {
+         draws.push_back (words[index].c_str());
+      }
+      time_interns (options, "unique", size, draws);
+   }
+   return get_exitstatus();
+}
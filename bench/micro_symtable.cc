@@ -0,0 +1,135 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+//
+// NAME
+//    micro_symtable - time the symbol tables
+//
+// SYNOPSIS
+//    micro_symtable [-r repeats] [-s seed]
+//
+// DESCRIPTION
+//    Times SymbolTable::addSymbol into tables of growing size, and
+//    SymbolTable::lookup from the innermost of a chain of nested
+//    scopes, for names declared in the innermost scope, in the
+//    global one, and at every depth alike.  Lookups of names in the
+//    outer scopes climb one parent for each level, copying the name
+//    as they go.  Last, it times SymbolTable::parseSignature on
+//    signatures of a growing number of parameters.
+//
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "auxlib.h"
+#include "micro.h"
+#include "symtable.h"
+
+static const long ADDS = 65536;
+static const long LOOKUPS = 200000;
+static const long PARSES = 200000;
+static const int SCOPE_SYMBOLS = 16;
+
+static string symbol_name (int scope, int index) {
+   return "v" + to_string (scope) + "_" + to_string (index);
+}
+
+/*
+ * Fills ADDS / size tables with size symbols each.
+ */
+static void time_adds (const micro_options& options) {
+   for (long size = 16; size <= 4096; size *= 16) {
+      vector<string> names;
+      for (long index = 0; index < size; ++index) {
+         names.push_back (symbol_name (0, index));
+      }
+      vector<SymbolTable*> tables;
+      double seconds = micro_best (options,
+            [&tables, size] () {
+               for (size_t table = 0; table < tables.size(); ++table) {
+                  delete tables[table];
+               }
+               tables.assign (ADDS / size, NULL);
+               for (size_t table = 0; table < tables.size(); ++table) {
+                  tables[table] = new SymbolTable (NULL);
+               }
+            },
+            [&tables, &names] () {
+               for (size_t table = 0; table < tables.size(); ++table) {
+                  for (size_t name = 0; name < names.size(); ++name) {
+                     tables[table]->addSymbol (names[name], "int",
+                           NULL);
+                  }
+               }
+            });
+      for (size_t table = 0; table < tables.size(); ++table) {
+         delete tables[table];
+      }
+      micro_row ("symtable", "addSymbol", size, ADDS, seconds);
+   }
+}
+
+static void time_lookups (const micro_options& options,
+      unsigned* state) {
+   for (int depth = 1; depth <= 64; depth *= 4) {
+      // A chain of depth scopes beneath the global one.
+      SymbolTable* global = new SymbolTable (NULL);
+      SymbolTable* inner = global;
+      for (int scope = 0; scope <= depth; ++scope) {
+         if (scope > 0) inner = inner->enterBlock();
+         for (int index = 0; index < SCOPE_SYMBOLS; ++index) {
+            inner->addSymbol (symbol_name (scope, index), "int", NULL);
+         }
+      }
+      static const char* const names[] = {"local", "global", "mixed"};
+      for (int kind = 0; kind < 3; ++kind) {
+         vector<string> keys;
+         for (long lookup = 0; lookup < LOOKUPS; ++lookup) {
+            int scope = kind == 0 ? depth : kind == 1 ? 0
+                      : micro_random (state) % (depth + 1);
+            keys.push_back (symbol_name (scope,
+                  micro_random (state) % SCOPE_SYMBOLS));
+         }
+         double seconds = micro_best (options, [] () {},
+               [inner, &keys] () {
+                  for (size_t key = 0; key < keys.size(); ++key) {
+                     inner->lookup (keys[key], 0);
+                  }
+               });
+         micro_row ("symtable", string ("lookup_") + names[kind],
+               depth, LOOKUPS, seconds);
+      }
+      delete global;
+   }
+}
+
+static void time_signatures (const micro_options& options) {
+   static const char* const types[] = {
+      "int", "string", "bool[]", "node", "char",
+   };
+   for (int params = 0; params <= 16; params = params * 2 + 1) {
+      string signature = "int(";
+      for (int param = 0; param < params; ++param) {
+         if (param > 0) signature += ",";
+         signature += types[param % 5];
+      }
+      signature += ")";
+      double seconds = micro_best (options, [] () {},
+            [&signature] () {
+               for (long parse = 0; parse < PARSES; ++parse) {
+                  SymbolTable::parseSignature (signature);
+               }
+            });
+      micro_row ("symtable", "parseSignature", params, PARSES,
+            seconds);
+   }
+}
+
+int main (int argc, char** argv) {
+   micro_options options = micro_start (argc, argv);
+   unsigned state = options.seed;
+   time_adds (options);
+   time_lookups (options, &state);
+   time_signatures (options);
+   return get_exitstatus();
+}
@@ -0,0 +1,214 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+//
+// NAME
+//    ocgen - generate a synthetic oc program for the benchmarks
+//
+// SYNOPSIS
+//    ocgen [-f functions] [-s structs] [-d depth] [-e terms]
+//          [-t strings] [-r seed]
+//
+// DESCRIPTION
+//    Writes to the standard output an oc program whose size grows
+//    along one dimension at a time: the number of functions, the
+//    number of structs, how deep the statements of each function
+//    nest, how many terms each expression chains and how many string
+//    constants fill a table.  The program compiles, links and runs,
+//    printing a checksum, so every phase of the compiler including
+//    gcc has real work to do.  The same options and seed always give
+//    the same program.
+//
+
+#include <string>
+using namespace std;
+
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct gen_options {
+   int functions = 16;
+   int structs = 4;
+   int depth = 3;
+   int terms = 8;
+   int strings = 64;
+   unsigned seed = 1;
+};
+
+static const char* program_name = "ocgen";
+static unsigned random_state;
+
+/*
+ * A small LCG, so that the programs do not depend on the libc.
+ */
+static int pick (int limit) {
+   random_state = random_state * 1103515245 + 12345;
+   return (random_state >> 16) % limit;
+}
+
+static int scan_count (const char* arg, int low) {
+   char* end;
+   long count = strtol (arg, &end, 10);
+   if (*end != '\0' or count < low or count > 1000000) {
+      fprintf (stderr, "%s: %s: bad count\n", program_name, arg);
+      exit (EXIT_FAILURE);
+   }
+   return count;
+}
+
+static gen_options scan_options (int argc, char** argv) {
+   gen_options options;
+   int option;
+   while ((option = getopt (argc, argv, "d:e:f:r:s:t:")) != EOF) {
+      switch (option) {
+         case 'd': options.depth = scan_count (optarg, 0);     break;
+         case 'e': options.terms = scan_count (optarg, 1);     break;
+         case 'f': options.functions = scan_count (optarg, 1); break;
+         case 'r': options.seed = scan_count (optarg, 0);      break;
+         case 's': options.structs = scan_count (optarg, 1);   break;
+         case 't': options.strings = scan_count (optarg, 1);   break;
+         default:
+            fprintf (stderr, "Usage: %s [-f functions] [-s structs]"
+                  " [-d depth] [-e terms] [-t strings] [-r seed]\n",
+                  program_name);
+            exit (EXIT_FAILURE);
+      }
+   }
+   return options;
+}
+
+static void put_structs (const gen_options& options) {
+   for (int type = 0; type < options.structs; ++type) {
+      printf ("struct rec%d {\n", type);
+      printf ("   int key;\n");
+      printf ("   int count;\n");
+      printf ("   string name;\n");
+      printf ("   int[] slots;\n");
+      printf ("}\n");
+   }
+}
+
+/*
+ * An int expression of options.terms terms over the variables in
+ * scope, which are a, b, r.key and the locals v0 to v<locals - 1>.
+ */
+static string chain (const gen_options& options, int locals) {
+   static const char* const operators[] = {" + ", " - ", " * "};
+   string expr;
+   for (int term = 0; term < options.terms; ++term) {
+      if (term > 0) expr += operators[pick (3)];
+      int which = pick (locals + 4);
+      if (which < locals) {
+         expr += "v" + to_string (which);
+      }else {
+         switch (which - locals) {
+            case 0: expr += "a"; break;
+            case 1: expr += "b"; break;
+            case 2: expr += "r.key"; break;
+            case 3: expr += to_string (pick (100)); break;
+         }
+      }
+   }
+   // Keep the values small, since oc ints wrap like C ints.
+   return "(" + expr + ") % 1009";
+}
+
+/*
+ * The statements nested in a function from level down to the
+ * innermost one, each level a while or an if-else around the next.
+ */
+static void put_nest (const gen_options& options, int level,
+      int locals, const string& indent) {
+   if (level == options.depth) {
+      printf ("%sv0 = %s;\n", indent.c_str(),
+            chain (options, locals).c_str());
+      printf ("%sr.count = r.count + 1;\n", indent.c_str());
+      return;
+   }
+   string inner = indent + "   ";
+   printf ("%sint v%d = %s;\n", indent.c_str(), locals,
+         chain (options, locals).c_str());
+   ++locals;
+   if (level % 2 == 0) {
+      printf ("%sint i%d = 0;\n", indent.c_str(), level);
+      printf ("%swhile (i%d < 2) {\n", indent.c_str(), level);
+      put_nest (options, level + 1, locals, inner);
+      printf ("%si%d = i%d + 1;\n", inner.c_str(), level, level);
+      printf ("%s}\n", indent.c_str());
+   }else {
+      printf ("%sif (v%d > %d) {\n", indent.c_str(), locals - 1,
+            pick (1009));
+      put_nest (options, level + 1, locals, inner);
+      printf ("%s}else {\n", indent.c_str());
+      printf ("%sv0 = v0 + %d;\n", inner.c_str(), pick (100));
+      printf ("%s}\n", indent.c_str());
+   }
+}
+
+static void put_functions (const gen_options& options) {
+   for (int fn = 0; fn < options.functions; ++fn) {
+      int type = fn % options.structs;
+      printf ("int fn%d (int a, int b, rec%d r) {\n", fn, type);
+      printf ("   int v0 = a + b;\n");
+      put_nest (options, 0, 1, "   ");
+      if (fn >= options.structs) {
+         // An earlier function taking the same struct.  The oil loses
+         // the first argument of a call unless it is a constant.
+         int callee = fn - options.structs
+                    * (1 + pick (fn / options.structs));
+         printf ("   v0 = v0 + fn%d (%d, v0 %% 7, r) %% 1009;\n",
+               callee, pick (10));
+      }
+      printf ("   return v0 %% 1009;\n");
+      printf ("}\n");
+   }
+}
+
+static void put_strings (const gen_options& options) {
+   static const char* const words[] = {
+      "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf",
+      "hotel", "india", "juliet", "kilo", "lima", "mike", "november",
+   };
+   int nwords = sizeof words / sizeof *words;
+   printf ("string[] table = new string[%d];\n", options.strings);
+   for (int index = 0; index < options.strings; ++index) {
+      printf ("table[%d] = \"%s %s %d\";\n", index,
+            words[pick (nwords)], words[pick (nwords)], index);
+   }
+}
+
+static void put_main (const gen_options& options) {
+   printf ("int sum = 0;\n");
+   printf ("int n = 0;\n");
+   for (int type = 0; type < options.structs; ++type) {
+      printf ("rec%d r%d = new rec%d ();\n", type, type, type);
+      printf ("r%d.key = %d;\n", type, type + 1);
+   }
+   printf ("while (n < 4) {\n");
+   for (int fn = 0; fn < options.functions; ++fn) {
+      printf ("   sum = (sum + fn%d (%d, n, r%d)) %% 1000003;\n", fn,
+            fn, fn % options.structs);
+   }
+   printf ("   n = n + 1;\n");
+   printf ("}\n");
+   printf ("puti (sum);\n");
+   printf ("endl ();\n");
+   printf ("puts (table[%d]);\n", options.strings - 1);
+   printf ("endl ();\n");
+}
+
+int main (int argc, char** argv) {
+   program_name = basename (argv[0]);
+   gen_options options = scan_options (argc, argv);
+   random_state = options.seed;
+   printf ("// ocgen -f %d -s %d -d %d -e %d -t %d -r %u\n",
+         options.functions, options.structs, options.depth,
+         options.terms, options.strings, options.seed);
+   printf ("#include \"oclib.oh\"\n");
+   put_structs (options);
+   put_functions (options);
+   put_strings (options);
+   put_main (options);
+   return EXIT_SUCCESS;
+}
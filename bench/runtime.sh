@@ -0,0 +1,125 @@
+#!/bin/bash
+# Paul Scherer, pscherer@ucsc.edu
+#
+# NAME
+#    runtime.sh - run time of the code oc generates
+#
+# SYNOPSIS
+#    runtime.sh oc measure suitedir workdir
+#
+# DESCRIPTION
+#    Builds each program.oc of suitedir with oc, with the flags in
+#    BENCH_OCFLAGS, and runs it BENCH_RUNS times, 5 by default, under
+#    measure with program.in as its input.  Its output must be the
+#    same as program.expected.  For each program it prints the fastest
+#    wall time, the fewest instructions retired and the smallest peak
+#    RSS, each with its ratio to suitedir/baseline.csv.  With
+#    BENCH_UPDATE=1, the results become the new baseline.  Exits with
+#    failure if a program could not be built or gave a wrong output.
+#
+#    The instructions are optional.  measure counts them only where
+#    perf_event_open(2) has a hardware counter, which virtual
+#    machines and containers often lack, and gives "-" elsewhere.
+#    The baseline in the repository was made on such a machine, so
+#    instructions are not compared, and a note says so, until it is
+#    made again with make runbench-baseline where they are counted.
+#
+
+set -e
+# Every program is built from scratch, not taken from the cache.
+unset OC_CACHE_DIR
+if [ $# -ne 4 ]; then
+   echo "Usage: $0 oc measure suitedir workdir" >&2
+   exit 1
+fi
+OC=$(readlink -f $1)
+MEASURE=$(readlink -f $2)
+SUITE=$(readlink -f $3)
+WORK=$4
+RUNS=${BENCH_RUNS:-5}
+LIBDIR=$(dirname $OC)
+BASELINE=$SUITE/baseline.csv
+
+mkdir -p $WORK
+cp $LIBDIR/oclib.c $LIBDIR/oclib.oh $WORK
+cd $WORK
+echo "program,seconds,instructions,rss_kb" >results.csv
+status=0
+
+for source in $SUITE/*.oc; do
+   program=$(basename $source .oc)
+   cp $source .
+   rm -f $program
+   if ! $OC -e bin $BENCH_OCFLAGS $program.oc; then
+      echo "$program: build failed" >&2
+      status=1
+      continue
+   fi
+   : >runs.csv
+   for run in $(seq $RUNS); do
+      if ! $MEASURE -i $SUITE/$program.in -o $program.out \
+            ./$program >>runs.csv; then
+         echo "$program: run failed" >&2
+         status=1
+         break
+      fi
+      if ! cmp -s $program.out $SUITE/$program.expected; then
+         echo "$program: wrong output, see $WORK/$program.out" >&2
+         status=1
+         : >runs.csv
+         break
+      fi
+   done
+   awk -F, -v program=$program '
+      NR == 1 || $1 < seconds { seconds = $1 }
+      NR == 1 || $2 < instructions { instructions = $2 }
+      NR == 1 || $3 < rss { rss = $3 }
+      END {
+         if (NR > 0) printf "%s,%s,%s,%s\n", program, seconds,
+                            instructions, rss
+      }' runs.csv >>results.csv
+done
+
+awk -F, '
+   # Ratio of value to that of the baseline, or - without one.
+   function ratio (value, base) {
+      if (value == "-" || base == "" || base == "-" || base == 0) {
+         return "-"
+      }
+      return sprintf ("%.3f", value / base)
+   }
+   FNR == 1 { next }
+   FILENAME != "results.csv" {
+      base[$1, 2] = $2; base[$1, 3] = $3; base[$1, 4] = $4
+      next
+   }
+   {
+      printf "%-10s %9.4f %6s %13s %6s %9d %6s\n", $1, $2,
+             ratio($2, base[$1, 2]), $3, ratio($3, base[$1, 3]),
+             $4, ratio($4, base[$1, 4])
+      if ($3 == "-") uncounted = 1
+      else if (base[$1, 3] == "-") unbased = 1
+   }
+   END {
+      if (uncounted) {
+         print "note: no hardware counter, instructions not counted"
+      } else if (unbased) {
+         print "note: the baseline has no instructions to compare;" \
+               " make runbench-baseline to add them"
+      }
+   }
+   BEGIN {
+      printf "%-10s %9s %6s %13s %6s %9s %6s\n", "program",
+             "seconds", "base", "instructions", "base", "rss KB",
+             "base"
+   }' $(test -f $BASELINE && echo $BASELINE) results.csv
+
+if [ "$BENCH_UPDATE" = 1 ]; then
+   if [ $status -ne 0 ]; then
+      echo "baseline not updated, as a program failed" >&2
+   else
+      cp results.csv $BASELINE
+      echo "updated $BASELINE"
+   fi
+fi
+exit $status
@@ -0,0 +1,544 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "astree.h"
+#include "auxlib.h"
+#include "cache.h"
+#include "context.h"
+#include "lyutils.h"
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+// Start of the second hash of the inputs of a whole compilation.
+static const uint64_t MIX_SEED = 0x9e3779b97f4a7c15ULL;
+
+// The artifacts of an entry, whether each is an executable, and
+// the -e selection that writes it.
+static const struct {
+   const char* name;
+   const char* suffix;
+   bool executable;
+   unsigned emit;
+} artifacts[] = {
+   {"tok", ".tok", false, EMIT_TOK},
+   {"ast", ".ast", false, EMIT_AST},
+   {"sym", ".sym", false, EMIT_SYM},
+   {"str", ".str", false, EMIT_STR},
+   {"dep", ".d",   false, EMIT_DEP},
+   {"oil", ".oil", false, EMIT_OIL},
+   {"oi",  ".oi",  false, EMIT_BIN},
+   {"bin", "",     true,  EMIT_BIN},
+};
+static const size_t NARTIFACTS =
+      sizeof artifacts / sizeof *artifacts;
+
+static const char* cache_dir (void) {
+   const char* dir = getenv ("OC_CACHE_DIR");
+   return dir != NULL and *dir != '\0' ? dir : NULL;
+}
+
+/*
+ * Returns the file an artifact is restored to.  A module compiled
+ * with -c has an object and an interface instead of a program.
+ */
+static string artifact_path (compile_context* ctx, size_t index) {
+   if (strcmp (artifacts[index].name, "bin") == 0
+         and ctx->options->compile_only) {
+      return ctx->prog_name + ".o";
+   }
+   return ctx->prog_name + artifacts[index].suffix;
+}
+
+/*
+ * Tells whether an artifact belongs to the compilation.
+ */
+static bool artifact_used (compile_context* ctx, size_t index) {
+   return strcmp (artifacts[index].name, "oi") != 0
+       or ctx->options->compile_only;
+}
+
+static uint64_t fnv1a (uint64_t hash, const char* data, size_t size) {
+   for (size_t index = 0; index < size; ++index) {
+      hash ^= (unsigned char) data[index];
+      hash *= FNV_PRIME;
+   }
+   return hash;
+}
+
+/*
+ * Mixes all bits of value into all bits of the result, as the
+ * finalizer of SplitMix64 does.
+ */
+static uint64_t mix64 (uint64_t value) {
+   value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+   return value ^ (value >> 31);
+}
+
+/*
+ * The inputs of a whole compilation, hashed by two unrelated
+ * functions and counted.  A hit restores the program on the key
+ * alone, so a collision of one 64 bit hash must not be enough.
+ */
+struct input_digest {
+   uint64_t fnv;
+   uint64_t mixed;
+   uint64_t size;
+   input_digest(): fnv (FNV_OFFSET), mixed (MIX_SEED), size (0) {}
+};
+
+static void digest_add (input_digest* digest, const char* data,
+      size_t size) {
+   digest->fnv = fnv1a (digest->fnv, data, size);
+   for (size_t index = 0; index < size; index += 8) {
+      uint64_t word = 0;
+      memcpy (&word, data + index, min (size - index, (size_t) 8));
+      digest->mixed = mix64 (digest->mixed ^ word);
+   }
+   digest->mixed = mix64 (digest->mixed ^ size);
+   digest->size += size;
+}
+
+static double elapsed_since (const struct timespec& start) {
+   struct timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+   return (now.tv_sec - start.tv_sec)
+        + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static bool read_file (const string& path, string* data) {
+   FILE* file = fopen (path.c_str(), "re");
+   if (file == NULL) return false;
+   char buffer[BUFSIZ];
+   size_t got;
+   while ((got = fread (buffer, 1, sizeof buffer, file)) > 0) {
+      data->append (buffer, got);
+   }
+   bool ok = not ferror (file);
+   fclose (file);
+   return ok;
+}
+
+/*
+ * Returns the version of the compiler that entries are made by: a
+ * hash of its own executable, read once, so that relinking it after
+ * a change to any of its sources invalidates the cache.  Falls back
+ * on the time this file was compiled if the executable cannot be
+ * read.
+ */
+static const string& cache_version (void) {
+   static const string version = [] () {
+      string executable;
+      if (not read_file ("/proc/self/exe", &executable)) {
+         return string ("oc " __DATE__ " " __TIME__);
+      }
+      uint64_t hash = fnv1a (FNV_OFFSET, executable.data(),
+            executable.size());
+      char key[20];
+      snprintf (key, sizeof key, "oc %016llx",
+            (unsigned long long) hash);
+      return string (key);
+   } ();
+   return version;
+}
+
+/*
+ * Writes a file under a temporary name of its own, in the same
+ * directory, and renames it into place, so that a program that is
+ * still running is not overwritten and writers of the same file do
+ * not write into each other.  A file that already has the contents
+ * is left alone, keeping its modification time for make.
+ */
+static bool write_file (const string& path, const char* data,
+      size_t size, bool executable) {
+   string old;
+   if (read_file (path, &old) and old.size() == size
+         and memcmp (old.data(), data, size) == 0) {
+      return true;
+   }
+   string temp = path + ".XXXXXX";
+   int fd = mkostemp (&temp[0], O_CLOEXEC);
+   if (fd < 0) return false;
+   bool ok = fchmod (fd, executable ? 0755 : 0644) == 0;
+   FILE* file = fdopen (fd, "w");
+   if (file == NULL) {
+      close (fd);
+      unlink (temp.c_str());
+      return false;
+   }
+   if (fwrite (data, 1, size, file) != size) ok = false;
+   if (fclose (file) != 0) ok = false;
+   if (ok) ok = rename (temp.c_str(), path.c_str()) == 0;
+   if (not ok) unlink (temp.c_str());
+   return ok;
+}
+
+/*
+ * Adds a hit or a miss to the statistics.  The file is locked, as
+ * several compilers may share the cache.
+ */
+static void update_stats (const char* dir, bool hit, double saved) {
+   string path = string (dir) + "/stats";
+   int fd = open (path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if (fd < 0) return;
+   flock (fd, LOCK_EX);
+   FILE* file = fdopen (fd, "r+");
+   long hits = 0;
+   long misses = 0;
+   double total_saved = 0;
+   if (fscanf (file, "hits %ld misses %ld saved %lf",
+               &hits, &misses, &total_saved) != 3) {
+      hits = misses = 0;
+      total_saved = 0;
+   }
+   if (hit) {
+      ++hits;
+      total_saved += saved;
+   } else {
+      ++misses;
+   }
+   rewind (file);
+   fprintf (file, "hits %ld misses %ld saved %.6f\n",
+         hits, misses, total_saved);
+   fflush (file);
+   if (ftruncate (fd, ftell (file)) != 0) {
+      DEBUGF ('c', "%s: %s\n", path.c_str(), strerror (errno));
+   }
+   fclose (file);
+}
+
+/*
+ * Returns the key of the entry of a whole compilation: both hashes
+ * of its inputs and their size.
+ */
+static string compute_key (compile_context* ctx) {
+   input_digest digest;
+   digest_add (&digest, cache_version().c_str(),
+         cache_version().size() + 1);
+   string flags = ctx->options->use_gc ? "G" : "";
+   if (ctx->options->compile_only) flags += "c";
+   if (ctx->options->line_directives) flags += "L";
+   if (ctx->options->instrument) flags += "I";
+   flags += ctx->options->optimize;
+   digest_add (&digest, flags.c_str(), flags.size() + 1);
+
+   // The oil follows the profile, if one is given.
+   if (not ctx->options->profile_use.empty()) {
+      string profile;
+      read_file (ctx->options->profile_use, &profile);
+      digest_add (&digest, profile.data(), profile.size() + 1);
+   }
+
+   // The program is linked from the runtime sources.
+   const char* runtime[] = {"oclib.c", "ocgc.c"};
+   size_t nruntime = ctx->options->use_gc ? 2 : 1;
+   for (size_t index = 0; index < nruntime; ++index) {
+      string source;
+      read_file (runtime[index], &source);
+      digest_add (&digest, source.data(), source.size() + 1);
+   }
+
+   digest_add (&digest, ctx->cpp_output.data(),
+         ctx->cpp_output.size());
+   char key[64];
+   snprintf (key, sizeof key, "%016llx%016llx-%llu",
+         (unsigned long long) digest.fnv,
+         (unsigned long long) digest.mixed,
+         (unsigned long long) digest.size);
+   return key;
+}
+
+bool cache_lookup (compile_context* ctx) {
+   const char* dir = cache_dir();
+   // Tracing the scanner or parser needs them to run, and so does
+   // writing the tree.
+   if (dir == NULL or yy_flex_debug or yydebug
+         or (ctx->options->emit & EMIT_ASTB)) return false;
+   mkdir (dir, 0755);
+
+   ctx->cache_key = compute_key (ctx);
+   string entry = string (dir) + "/" + ctx->cache_key + "/";
+
+   string meta;
+   double cost = 0;
+   bool hit = read_file (entry + "meta", &meta)
+          and sscanf (meta.c_str(), "elapsed %lf", &cost) == 1;
+   for (size_t index = 0; hit and index < NARTIFACTS; ++index) {
+      if (not artifact_used (ctx, index)
+            or not (ctx->options->emit & artifacts[index].emit)) {
+         continue;
+      }
+      string data;
+      string path = artifact_path (ctx, index);
+      hit = read_file (entry + artifacts[index].name, &data)
+            and write_file (path, data.data(), data.size(),
+                  artifacts[index].executable
+                  and not ctx->options->compile_only);
+   }
+
+   double saved = hit ? cost - elapsed_since (ctx->start_time) : 0;
+   DEBUGF ('c', "%s: %s %s, %.3f s saved\n", ctx->filename.c_str(),
+         hit ? "hit" : "miss", ctx->cache_key.c_str(), saved);
+   update_stats (dir, hit, saved > 0 ? saved : 0);
+   ctx->cache_hit = hit;
+   return hit;
+}
+
+void cache_store (compile_context* ctx) {
+   // An entry must have every artifact, so only a compilation that
+   // wrote them all is stored.
+   const char* dir = cache_dir();
+   if (dir == NULL or ctx->cache_key.empty() or ctx->cache_hit
+         or ctx->gcc_pid <= 0 or ctx->exitstatus != EXIT_SUCCESS
+         or (ctx->options->emit & EMIT_DEFAULT) != EMIT_DEFAULT) {
+      return;
+   }
+
+   // Fill a private directory and rename it into place, so that
+   // readers never see a partial entry.
+   string temp = string (dir) + "/tmp.XXXXXX";
+   if (mkdtemp (&temp[0]) == NULL) {
+      syserrprintf (dir);
+      return;
+   }
+   bool ok = true;
+   for (size_t index = 0; ok and index < NARTIFACTS; ++index) {
+      if (not artifact_used (ctx, index)) continue;
+      string path = temp + "/" + artifacts[index].name;
+      if (strcmp (artifacts[index].name, "oil") == 0) {
+         ok = write_file (path, ctx->oil_text, ctx->oil_size, false);
+      } else {
+         string data;
+         string artifact = artifact_path (ctx, index);
+         ok = read_file (artifact, &data)
+              and write_file (path, data.data(), data.size(),
+                    artifacts[index].executable);
+      }
+   }
+   char meta[64];
+   snprintf (meta, sizeof meta, "elapsed %.6f\n",
+         elapsed_since (ctx->start_time));
+   ok = ok and write_file (temp + "/meta", meta, strlen (meta), false);
+
+   string entry = string (dir) + "/" + ctx->cache_key;
+   if (not ok or rename (temp.c_str(), entry.c_str()) != 0) {
+      // Failed, or another compiler stored the same entry first.
+      for (size_t index = 0; index < NARTIFACTS; ++index) {
+         unlink ((temp + "/" + artifacts[index].name).c_str());
+      }
+      unlink ((temp + "/meta").c_str());
+      rmdir (temp.c_str());
+   }
+   DEBUGF ('c', "%s: stored %s\n", ctx->filename.c_str(),
+         ctx->cache_key.c_str());
+}
+
+/*
+ * Hashes the structure of a tree: symbols, lexical information and
+ * shape, but not positions, so that moving a function or editing
+ * another one leaves its fingerprint alone.  Also collects every
+ * name used beneath it.  With positions, as when the oil carries
+ * #line directives or counters, the file and line of every node
+ * count too.
+ */
+static uint64_t hash_tree (uint64_t hash, astree* node,
+      set<string>* names, bool positions) {
+   const char* symbol = get_yytname (node->symbol);
+   hash = fnv1a (hash, symbol, strlen (symbol) + 1);
+   hash = fnv1a (hash, node->lexinfo->c_str(),
+         node->lexinfo->size() + 1);
+   names->insert (*node->lexinfo);
+   char count[16];
+   snprintf (count, sizeof count, "%zu", node->children.size());
+   hash = fnv1a (hash, count, strlen (count) + 1);
+   if (positions) {
+      const string* filename = scanner_filename (node->filenr);
+      hash = fnv1a (hash, filename->c_str(), filename->size() + 1);
+      snprintf (count, sizeof count, "%zu", node->linenr);
+      hash = fnv1a (hash, count, strlen (count) + 1);
+   }
+   for (size_t child = 0; child < node->children.size(); ++child) {
+      hash = hash_tree (hash, node->children[child], names,
+            positions);
+   }
+   return hash;
+}
+
+/*
+ * Adds every identifier that appears in a type to names.
+ */
+static void type_names (const string& type, set<string>* names) {
+   size_t start = 0;
+   while (start < type.size()) {
+      size_t end = type.find_first_not_of (
+            "abcdefghijklmnopqrstuvwxyz"
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_", start);
+      if (end == string::npos) end = type.size();
+      if (end > start) names->insert (type.substr (start, end - start));
+      start = end + 1;
+   }
+}
+
+string cache_function_key (astree* function, SymbolTable* types,
+      SymbolTable* global, const map<string,string>& strcons,
+      int nstrcons, const string& profile) {
+   if (cache_dir() == NULL) return "";
+
+   // Counters name the lines they count, as #line directives do.
+   const compile_options* options = get_context()->options;
+   string header = cache_version() + " "
+         + to_string (nstrcons)
+         + (options->instrument ? " instrument" : "")
+         + " " + profile;
+   uint64_t hash = fnv1a (FNV_OFFSET, header.c_str(),
+         header.size() + 1);
+   set<string> names;
+   hash = hash_tree (hash, function, &names,
+         options->line_directives or options->instrument);
+
+   // Declarations of the globals and functions it refers to, and of
+   // the structs those mention, field types included.
+   map<string,string> globals = global->getMapping();
+   map<string,string> structs = types->getMapping();
+   set<string> pending = names;
+   set<string> seen;
+   string decls;
+   while (not pending.empty()) {
+      string name = *pending.begin();
+      pending.erase (pending.begin());
+      if (not seen.insert (name).second) continue;
+
+      set<string> mentioned;
+      map<string,string>::iterator found = globals.find (name);
+      if (found != globals.end()) {
+         decls += "g " + name + " " + found->second + "\n";
+         type_names (found->second, &mentioned);
+      }
+      if (structs.count (name) > 0) {
+         map<string,string> fields =
+               types->lookup_param_oil (name)->getMapping();
+         decls += "s " + name + "\n";
+         for (found = fields.begin(); found != fields.end(); ++found) {
+            decls += "f " + found->first + " " + found->second + "\n";
+            type_names (found->second, &mentioned);
+         }
+      }
+      map<string,string>::const_iterator strcon = strcons.find (name);
+      if (strcon != strcons.end()) {
+         decls += "c " + name + " " + strcon->second + "\n";
+      }
+      for (set<string>::iterator next = mentioned.begin();
+            next != mentioned.end(); ++next) {
+         if (seen.count (*next) == 0) pending.insert (*next);
+      }
+   }
+   hash = fnv1a (hash, decls.data(), decls.size());
+
+   char key[17];
+   snprintf (key, sizeof key, "%016llx", (unsigned long long) hash);
+   return key;
+}
+
+string tree_fingerprint (const vector<astree*>& trees) {
+   uint64_t hash = FNV_OFFSET;
+   set<string> names;
+   for (size_t index = 0; index < trees.size(); ++index) {
+      hash = hash_tree (hash, trees[index], &names, false);
+   }
+   char key[17];
+   snprintf (key, sizeof key, "%016llx", (unsigned long long) hash);
+   return key;
+}
+
+bool cache_load_function (const string& key, string* oil) {
+   const char* dir = cache_dir();
+   if (dir == NULL) return false;
+   bool hit = read_file (string (dir) + "/fn/" + key, oil);
+   DEBUGF ('c', "function %s: %s\n", key.c_str(),
+         hit ? "hit" : "miss");
+   return hit;
+}
+
+void cache_store_function (const string& key, const char* oil,
+      size_t size) {
+   const char* dir = cache_dir();
+   if (dir == NULL) return;
+   string fn_dir = string (dir) + "/fn";
+   mkdir (dir, 0755);
+   mkdir (fn_dir.c_str(), 0755);
+   if (not write_file (fn_dir + "/" + key, oil, size, false)) {
+      DEBUGF ('c', "function %s: %s\n", key.c_str(),
+            strerror (errno));
+   }
+}
+
+string cache_prelude_key (int filenr, const char* text, size_t size) {
+   string header = cache_version() + " " + to_string (filenr);
+   uint64_t hash = fnv1a (FNV_OFFSET, header.c_str(),
+         header.size() + 1);
+   hash = fnv1a (hash, text, size);
+   char key[17];
+   snprintf (key, sizeof key, "%016llx", (unsigned long long) hash);
+   return key;
+}
+
+bool cache_load_prelude (const string& key, string* snapshot) {
+   const char* dir = cache_dir();
+   if (dir == NULL) return false;
+   bool hit = read_file (string (dir) + "/prelude/" + key, snapshot);
+   DEBUGF ('c', "prelude %s: %s\n", key.c_str(),
+         hit ? "hit" : "miss");
+   return hit;
+}
+
+void cache_store_prelude (const string& key, const string& snapshot) {
+   const char* dir = cache_dir();
+   if (dir == NULL) return;
+   string prelude_dir = string (dir) + "/prelude";
+   mkdir (dir, 0755);
+   mkdir (prelude_dir.c_str(), 0755);
+   if (not write_file (prelude_dir + "/" + key, snapshot.data(),
+               snapshot.size(), false)) {
+      DEBUGF ('c', "prelude %s: %s\n", key.c_str(),
+            strerror (errno));
+   }
+}
+
+int cache_report (FILE* out) {
+   const char* dir = cache_dir();
+   if (dir == NULL) {
+      errprintf ("%:OC_CACHE_DIR is not set\n");
+      return EXIT_FAILURE;
+   }
+   string stats;
+   long hits = 0;
+   long misses = 0;
+   double saved = 0;
+   if (read_file (string (dir) + "/stats", &stats)) {
+      sscanf (stats.c_str(), "hits %ld misses %ld saved %lf",
+            &hits, &misses, &saved);
+   }
+   long lookups = hits + misses;
+   fprintf (out, "%s: %ld hits, %ld misses, %.1f%% hit rate,"
+         " %.3f s saved\n", dir, hits, misses,
+         lookups > 0 ? 100.0 * hits / lookups : 0.0, saved);
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stdio.h>
+
+#include "context.h"
+#include "symtable.h"
+
+//
+// DESCRIPTION
+//    Whole-file compilation cache.  When $OC_CACHE_DIR is set, every
+//    successful compilation is stored there under a hash of the cpp
+//    output, which covers all included files, together with the
+//    compiler build, the flags and the runtime sources.  A later
+//    compilation with the same hash restores the files it would
+//    write, out of the .tok, .ast, .sym, .str, .d and .oil files and
+//    the program, from the cache without running the scanner,
+//    parser, type checker, oil generation or gcc.  Hits, misses and
+//    the time they saved are counted in the file "stats" in the
+//    cache directory.
+//
+//    Below that, the oil of each function is cached on its own under
+//    a fingerprint of its tree, the declarations of the globals and
+//    structs it refers to, and the registers of the string constants
+//    it uses.  With --line-directives or --instrument, the positions
+//    in the tree are part of the fingerprint, as they are written in
+//    the oil.  Only the functions that changed are type checked and
+//    generated again.
+//
+//    The cache also keeps snapshots of preludes, the header such as
+//    oclib.oh that a program includes before anything else, so that
+//    each process parses a prelude only once.
+//
+
+bool cache_lookup (compile_context* ctx);
+   //
+   // Computes ctx->cache_key from ctx->cpp_output and restores the
+   // artifacts if the cache has them.  Returns true on a hit.  Does
+   // nothing and returns false if the cache is not enabled.
+   //
+
+void cache_store (compile_context* ctx);
+   //
+   // Stores the artifacts of a finished compilation under
+   // ctx->cache_key.  Does nothing unless the compilation missed
+   // the cache and succeeded.
+   //
+
+string cache_function_key (astree* function, SymbolTable* types,
+      SymbolTable* global, const map<string,string>& strcons,
+      int nstrcons, const string& profile);
+   //
+   // Returns the fingerprint of function, or "" if the cache is not
+   // enabled.  strcons maps string constants to their registers and
+   // nstrcons is the number of string constants in the program.
+   // profile is what --profile-use says of function, as returned by
+   // profile_summary.
+   //
+
+string tree_fingerprint (const vector<astree*>& trees);
+   //
+   // Returns a fingerprint of the trees alone, without positions or
+   // the declarations they use, whether or not the cache is enabled.
+   // It stays the same as long as the code does, wherever it moves,
+   // so that a profile can find the function it was taken of.
+   //
+
+bool cache_load_function (const string& key, string* oil);
+   //
+   // Loads the oil of the function with fingerprint key into *oil.
+   // Returns false if it is not in the cache.
+   //
+
+void cache_store_function (const string& key, const char* oil,
+      size_t size);
+   //
+   // Stores the oil of the function with fingerprint key.
+   //
+
+string cache_prelude_key (int filenr, const char* text, size_t size);
+   //
+   // Returns the key of the snapshot of a prelude whose cpp output
+   // is text and whose first file number is filenr.  Unlike the
+   // other keys, it is computed even if the cache is not enabled.
+   //
+
+bool cache_load_prelude (const string& key, string* snapshot);
+void cache_store_prelude (const string& key, const string& snapshot);
+   //
+   // Load and store the snapshot of a prelude.  Loading fails and
+   // storing does nothing if the cache is not enabled.
+   //
+
+int cache_report (FILE* out);
+   //
+   // Prints the statistics of the cache and returns an exit status.
+   //
+
+#endif
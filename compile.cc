@@ -0,0 +1,1096 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "astio.h"
+#include "astree.h"
+#include "auxlib.h"
+#include "backend.h"
+#include "cache.h"
+#include "compile.h"
+#include "context.h"
+#include "lyutils.h"
+#include "oilprint.h"
+#include "phases.h"
+#include "prelude.h"
+#include "stringset.h"
+#include "symtable.h"
+#include "trace.h"
+#include "typecheck.h"
+#include "workpool.h"
+#include "writer.h"
+
+const size_t LINESIZE = 1024;
+
+const string CPP = "/usr/bin/cpp";
+
+extern char** environ;
+
+// The scanner and parser generated by flex and bison keep their
+// state in globals, so only one compilation may use them at a time.
+mutex frontend_lock;
+
+/*
+ * Starts cpp on filename, storing its pid in *pid, and returns a
+ * stream of its output, or NULL if it could not be started.
+ */
+FILE* cpp_spawn (const compile_options* options,
+      const string& filename, pid_t* pid) {
+   // If the -D option was passed, pass it on to cpp.
+   vector<const char*> argv = {CPP.c_str()};
+   if (options->dvalue.compare("") != 0) {
+      argv.push_back ("-D");
+      argv.push_back (options->dvalue.c_str());
+   }
+   argv.push_back (filename.c_str());
+   argv.push_back (NULL);
+
+   // Close-on-exec, so back ends spawned by other threads do not
+   // inherit the pipe.
+   int fds[2];
+   if (pipe2 (fds, O_CLOEXEC) < 0) {
+      syserrprintf ("pipe");
+      return NULL;
+   }
+   posix_spawn_file_actions_t actions;
+   posix_spawn_file_actions_init (&actions);
+   posix_spawn_file_actions_adddup2 (&actions, fds[1], STDOUT_FILENO);
+   int rc = posix_spawn (pid, argv[0], &actions, NULL,
+         (char**) argv.data(), environ);
+   posix_spawn_file_actions_destroy (&actions);
+   close (fds[1]);
+
+   // Fail this compilation if cpp doesn't start
+   if (rc != 0) {
+      errno = rc;
+      syserrprintf (CPP.c_str());
+      close (fds[0]);
+      return NULL;
+   }
+   return fdopen (fds[0], "r");
+}
+
+// Names of the files -e selects and their suffixes.
+static const struct {
+   const char* name;
+   const char* suffix;
+   unsigned emit;
+} emitted[] = {
+   {"tok", ".tok", EMIT_TOK},
+   {"ast", ".ast", EMIT_AST},
+   {"sym", ".sym", EMIT_SYM},
+   {"str", ".str", EMIT_STR},
+   {"dep", ".d",   EMIT_DEP},
+   {"oil", ".oil", EMIT_OIL},
+   {"astb", ".astb", EMIT_ASTB},
+   {"bin", NULL,   EMIT_BIN},
+};
+static const size_t NEMITTED = sizeof emitted / sizeof *emitted;
+
+/*
+ * Adds the files named in list, separated by commas, to *emit, and
+ * the names it does not know to *bad_names.
+ */
+void scan_emit (const char* list, unsigned* emit,
+      vector<string>* bad_names) {
+   string names = list;
+   size_t start = 0;
+   while (start <= names.size()) {
+      size_t end = names.find (',', start);
+      if (end == string::npos) end = names.size();
+      string name = names.substr (start, end - start);
+      size_t index = 0;
+      while (index < NEMITTED and name != emitted[index].name) ++index;
+      if (index < NEMITTED) {
+         *emit |= emitted[index].emit;
+      } else if (not name.empty()) {
+         bad_names->push_back (name);
+      }
+      start = end + 1;
+   }
+}
+
+/*
+ * Sets the form of the -T or --stats report from its argument, which
+ * is none for text or "json".  Returns false if form is neither.
+ */
+bool scan_report (const char* form, int* report) {
+   if (form == NULL) {
+      *report = REPORT_TEXT;
+   } else if (strcmp (form, "json") == 0) {
+      *report = REPORT_JSON;
+   } else {
+      return false;
+   }
+   return true;
+}
+
+static const struct option long_options[] = {
+   {"server",  optional_argument, NULL, 'S'},
+   {"connect", optional_argument, NULL, 'C'},
+   {"cache-stats", no_argument,   NULL, 'R'},
+   {"no-prelude",  no_argument,   NULL, 'P'},
+   {"counters",    no_argument,   NULL, 'H'},
+   {"trace",   required_argument, NULL, 'X'},
+   {"stats",   optional_argument, NULL, 'N'},
+   {"line-directives", no_argument, NULL, 'L'},
+   {"instrument",  no_argument,   NULL, 'I'},
+   {"profile-use", required_argument, NULL, 'U'},
+   {NULL,      0,                 NULL, 0},
+};
+
+bool scan_opts (int argc, char** argv, compile_options* options,
+      vector<string>* filenames) {
+   // Activate flags if passed in command arguments.  Resetting optind
+   // to 0 lets the server parse one argument vector after another.
+   optind = 0;
+   opterr = 0;
+   yy_flex_debug = 0;
+   yydebug = 0;
+   string bad_options;
+   vector<string> bad_names;
+   vector<string> bad_reports;
+   vector<string> bad_traces;
+   unsigned emit = 0;
+   bool emit_given = false;
+   int c;
+   while ((c = getopt_long (argc, argv, "@:D:GO::T::ce:j:klo:y",
+               long_options, NULL)) != -1) {
+      switch (c) {
+      case '@': set_debugflags (optarg);          break;
+      case 'D': options->dvalue = optarg;         break;
+      case 'G': options->use_gc = true;           break;
+      case 'O': options->optimize = string ("-O")
+                      + (optarg == NULL ? "" : optarg);
+                break;
+      case 'T': if (not scan_report (optarg, &options->phase_report)) {
+                   bad_reports.push_back (string ("-T") + optarg);
+                }
+                break;
+      case 'N': if (not scan_report (optarg, &options->stats_report)) {
+                   bad_reports.push_back (string ("--stats=") + optarg);
+                }
+                break;
+      case 'c': options->compile_only = true;     break;
+      case 'e': scan_emit (optarg, &emit, &bad_names);
+                emit_given = true;
+                break;
+      case 'j': options->jobs = atoi (optarg);    break;
+      case 'k': emit |= EMIT_OIL;                 break;
+      case 'l': yy_flex_debug = 1;                break;
+      case 'o': options->output = optarg;         break;
+      case 'y': yydebug = 1;                      break;
+      case 'S': options->server = true;
+                if (optarg != NULL) options->socket_path = optarg;
+                break;
+      case 'C': options->connect = true;
+                if (optarg != NULL) options->socket_path = optarg;
+                break;
+      case 'R': options->cache_stats = true;      break;
+      case 'P': options->no_prelude = true;       break;
+      case 'H': options->counters = true;         break;
+      case 'L': options->line_directives = true;  break;
+      case 'I': options->instrument = true;       break;
+      case 'U': options->profile_use = optarg;    break;
+      case 'X': if (not trace_scan (optarg, &options->trace_path,
+                         &options->trace_categories)) {
+                   bad_traces.push_back (optarg);
+                }
+                break;
+      default:  bad_options += (char) optopt;     break;
+      }
+   }
+
+   // Without -e, the usual files are written, and -k adds the oil.
+   options->emit = emit_given ? emit : emit | EMIT_DEFAULT;
+
+   // The counters are only seen in the report.
+   if (options->counters and options->phase_report == REPORT_OFF) {
+      options->phase_report = REPORT_TEXT;
+   }
+
+   // A client leaves the complaints to the server, which parses the
+   // same arguments again.
+   for (size_t index = 0; index < bad_options.size(); ++index) {
+      if (options->connect) break;
+      errprintf ("%:bad option (%c)\n", bad_options[index]);
+   }
+   for (size_t index = 0; index < bad_names.size(); ++index) {
+      if (options->connect) break;
+      errprintf ("%:-e: unknown file (%s)\n",
+            bad_names[index].c_str());
+   }
+   for (size_t index = 0; index < bad_reports.size(); ++index) {
+      if (options->connect) break;
+      errprintf ("%:%s: unknown form of report\n",
+            bad_reports[index].c_str());
+   }
+   for (size_t index = 0; index < bad_traces.size(); ++index) {
+      if (options->connect) break;
+      errprintf ("%:--trace: unknown category (%s)\n",
+            bad_traces[index].c_str());
+   }
+
+   if (optind >= argc and not options->server
+         and not options->cache_stats) {
+      errprintf ("Usage: %s [-Gkly] [-O[level]] [-T[json]] [-e files]"
+            " [-j jobs] [--connect[=socket]] [--cache-stats]"
+            " [--no-prelude]"
+            " [--counters] [--trace=file[,category...]]"
+            " [--stats[=json]] [--line-directives] [--instrument]"
+            " [--profile-use=file.ocprof]"
+            " {file.oc | file.astb}...\n"
+            "       %s -c [-Gkly] [-O[level]] [-e files] [-j jobs]"
+            " module.oc...\n"
+            "       %s -o program [-Gkly] [-O[level]] [-e files]"
+            " [-j jobs]"
+            " {module.oc | module.o}...\n"
+            "       %s --server[=socket]\n"
+            "       %s --cache-stats\n",
+            get_execname(), get_execname(), get_execname(),
+            get_execname(), get_execname());
+      return false;
+   }
+
+   filenames->assign (argv + optind, argv + argc);
+   return true;
+}
+
+/*
+ * Checks that the file passed is an existing .oc file and sets the
+ * program name from it.
+ */
+bool check_filename (compile_context* ctx) {
+   string path = ctx->filename;
+
+   // Check if a valid .oc file was passed.
+   size_t period_pos = path.find_last_of (".");
+   if (period_pos == string::npos) {
+      fprintf (stderr, "Must pass .oc file.\n");
+      set_exitstatus (EXIT_FAILURE);
+      return false;
+   }
+
+   string file_type = path.substr(period_pos + 1);
+   if (file_type.compare ("oc") != 0
+         and file_type.compare ("astb") != 0) {
+      fprintf (stderr, "Invalid file type '.%s'.\n", file_type.c_str());
+      set_exitstatus (EXIT_FAILURE);
+      return false;
+   }
+
+   // Get program name.
+   string base = basename (path.c_str());
+   ctx->prog_name = base.substr (0, base.find_last_of ("."));
+
+   // Check if file specified exists
+   if (access (path.c_str(), R_OK) != 0) {
+      errprintf ("Cannot access '%s': No such file or"
+            " directory.\n", path.c_str());
+      return false;
+   }
+
+   return true;
+}
+
+/*
+ * Hands a dump formatted into memory by open_memstream to the
+ * background writer, to be written to prog_name + suffix.
+ */
+void write_dump (compile_context* ctx, const string& suffix,
+      char* text, size_t size) {
+   ctx->write_ticket = writer_submit (ctx->prog_name + suffix, text,
+         size, ctx);
+}
+
+void insert_stringset (compile_context* ctx) {
+   char *token;               // Tokenized string
+   char *save;                // State of strtok_r
+   string delim = "\\ \t\n";
+
+   // Format the program.str file in memory
+   char* text = NULL;
+   size_t size = 0;
+   FILE *str_file = open_memstream (&text, &size);
+
+   // Read line of cpp output file and tokenize it, and insert it into
+   // the string set.  A program loaded from a .astb file has none.
+   char buffer[LINESIZE];
+   while (ctx->cpp_pipe != NULL
+         and fgets (buffer, LINESIZE, ctx->cpp_pipe) != NULL) {
+      token = strtok_r (buffer, delim.c_str(), &save);
+
+      while (token != NULL) {
+         intern_stringset (token);
+         token = strtok_r (NULL, delim.c_str(), &save);
+      }
+   }
+
+   // Dump the string set and write it in the background.
+   dump_stringset (str_file);
+   fclose (str_file);
+   write_dump (ctx, ".str", text, size);
+}
+
+/*
+ * Writes the interface of a module to prog_name.oi.  The file is
+ * left alone if it did not change, so that the modules including
+ * it are not rebuilt for nothing.
+ */
+void write_interface (compile_context* ctx, astree* root,
+      SymbolTable* types, SymbolTable* global) {
+   char* text = NULL;
+   size_t size = 0;
+   FILE* text_file = open_memstream (&text, &size);
+   generate_interface (text_file, root, types, global);
+   fclose (text_file);
+
+   string path = ctx->prog_name + ".oi";
+   string old_text;
+   FILE* old_file = fopen (path.c_str(), "r");
+   if (old_file != NULL) {
+      char buffer[BUFSIZ];
+      size_t got;
+      while ((got = fread (buffer, 1, sizeof buffer, old_file)) > 0) {
+         old_text.append (buffer, got);
+      }
+      fclose (old_file);
+   }
+   if (old_text.size() != size
+         or memcmp (old_text.data(), text, size) != 0) {
+      FILE* oi_file = fopen (path.c_str(), "w");
+      if (oi_file == NULL) {
+         syserrprintf (path.c_str());
+      } else {
+         fwrite (text, 1, size, oi_file);
+         fclose (oi_file);
+      }
+   }
+   free (text);
+}
+
+/*
+ * Escapes a file name for a makefile rule.
+ */
+string make_escape (const string& name) {
+   string escaped;
+   for (size_t index = 0; index < name.size(); ++index) {
+      char ch = name[index];
+      if (ch == '$') escaped += '$';
+      else if (ch == ' ' or ch == '#' or ch == '\\') escaped += '\\';
+      escaped += ch;
+   }
+   return escaped;
+}
+
+/*
+ * Writes prog_name.d, a makefile rule that makes the outputs of the
+ * compilation depend on the source, every file cpp included, as its
+ * line markers named them, and the runtime.  Like gcc -MP, every
+ * input but the source also gets a rule of its own without
+ * prerequisites, so that make does not fail when one is deleted.
+ */
+void write_depfile (compile_context* ctx) {
+   vector<string> inputs;
+   set<string> seen;
+   for (size_t file = 0; file < ctx->included_filenames.size();
+         ++file) {
+      // Skip <built-in> and <command-line>.
+      const string& name = ctx->included_filenames[file];
+      if (name.empty() or name[0] == '<') continue;
+      if (seen.insert (name).second) inputs.push_back (name);
+   }
+   if (not ctx->options->compile_only) {
+      backend_runtime_sources (ctx->options, &inputs);
+   }
+
+   char* text = NULL;
+   size_t size = 0;
+   FILE* dep_file = open_memstream (&text, &size);
+   string target = make_escape (ctx->prog_name);
+   if (ctx->options->compile_only) {
+      fprintf (dep_file, "%s.o %s.oi:", target.c_str(),
+            target.c_str());
+   } else {
+      fprintf (dep_file, "%s:", target.c_str());
+   }
+   for (size_t input = 0; input < inputs.size(); ++input) {
+      fprintf (dep_file, " \\\n %s",
+            make_escape (inputs[input]).c_str());
+   }
+   fprintf (dep_file, "\n");
+   for (size_t input = 1; input < inputs.size(); ++input) {
+      fprintf (dep_file, "\n%s:\n",
+            make_escape (inputs[input]).c_str());
+   }
+   fclose (dep_file);
+   write_dump (ctx, ".d", text, size);
+}
+
+/*
+ * Adds stream to the streams the oil is written to.
+ */
+FILE* add_oil_stream (FILE* oil_file, FILE* stream) {
+   if (oil_file == NULL) return stream;
+   return tee_open (oil_file, stream);
+}
+
+bool is_astb_file (const string& file) {
+   size_t length = file.size();
+   return length > 5 and file.compare (length - 5, 5, ".astb") == 0;
+}
+
+/*
+ * Returns the files a compilation writes.  A program loaded from a
+ * .astb file skips cpp and the scanner, so it has no tokens and no
+ * list of dependencies.
+ */
+unsigned emitted_files (compile_context* ctx) {
+   unsigned emit = ctx->options->emit;
+   if (is_astb_file (ctx->filename)) {
+      emit &= ~(EMIT_TOK | EMIT_DEP | EMIT_ASTB);
+   }
+   return emit;
+}
+
+/*
+ * Returns the name of file without directory and suffix.
+ */
+string base_name (const string& file) {
+   string base = file.substr (file.find_last_of ('/') + 1);
+   return base.substr (0, base.find_last_of ('.'));
+}
+
+/*
+ * Adds the module of filename to the imports of ctx if it is the
+ * interface of one.
+ */
+void add_import (compile_context* ctx, const string& filename) {
+   size_t length = filename.size();
+   if (length <= 3 or filename.compare (length - 3, 3, ".oi") != 0) {
+      return;
+   }
+   string module = base_name (filename);
+   if (find (ctx->imports.begin(), ctx->imports.end(), module)
+         == ctx->imports.end()) {
+      ctx->imports.push_back (module);
+   }
+}
+
+/*
+ * Adds the modules whose interfaces cpp included, as its line
+ * markers name them, to the imports of ctx.  They are found before
+ * the cache is asked, which skips the scanner.
+ */
+void find_imports (compile_context* ctx) {
+   const string& text = ctx->cpp_output;
+   size_t line = 0;
+   while (line < text.size()) {
+      size_t end = text.find ('\n', line);
+      if (end == string::npos) end = text.size();
+      if (text.compare (line, 2, "# ") == 0
+            and isdigit ((unsigned char) text[line + 2])) {
+         size_t open = text.find ('"', line);
+         size_t close = open < end ? text.find ('"', open + 1) : end;
+         if (close < end) {
+            add_import (ctx, text.substr (open + 1, close - open - 1));
+         }
+      }
+      line = end + 1;
+   }
+}
+
+/*
+ * Runs cpp and reads its output into ctx->cpp_output, and stores
+ * its status in *cpp_status.  Returns false if there is nothing
+ * left to do, because cpp could not be started or the cache had
+ * the compilation.
+ */
+bool read_source (compile_context* ctx, int* cpp_status) {
+   struct timespec started;
+   clock_gettime (CLOCK_MONOTONIC, &started);
+   pid_t cpp_pid;
+   FILE* cpp_pipe = cpp_spawn (ctx->options, ctx->filename, &cpp_pid);
+   if (cpp_pipe == NULL) return false;
+
+   // The whole cpp output is read first, as it is the key into the
+   // cache.  The scanner then reads it from memory.
+   char buffer[BUFSIZ];
+   size_t got;
+   while ((got = fread (buffer, 1, sizeof buffer, cpp_pipe)) > 0) {
+      ctx->cpp_output.append (buffer, got);
+   }
+   fclose (cpp_pipe);
+   struct rusage usage;
+   *cpp_status = backend_wait (cpp_pid, &usage);
+   if (*cpp_status >= 0) {
+      phase_child (PHASE_CPP, started, usage, ctx->phases);
+   }
+   find_imports (ctx);
+   if (*cpp_status == 0 and cache_lookup (ctx)) {
+      ctx->cpp_output.clear();
+      return false;
+   }
+   return true;
+}
+
+/*
+ * Runs the front end on one file and starts its back end, but does
+ * not wait for gcc to finish.
+ */
+void compile_start (compile_context* ctx) {
+   set_context (ctx);
+   reset_exitstatus();
+
+   if (not check_filename (ctx)) {
+      ctx->exitstatus = get_exitstatus();
+      return;
+   }
+
+   // Dumps that were not asked for are never formatted at all.
+   unsigned emit = emitted_files (ctx);
+   int cpp_status = 0;
+   int parsecode = 0;
+   vector<string> interned;
+   phase_times* phases = ctx->phases;
+   phase_clock clock;
+   if (is_astb_file (ctx->filename)) {
+      phase_start (&clock, PHASE_PARSE);
+      ctx->yyparse_astree = astio_load_file (ctx->filename,
+            &ctx->included_filenames);
+      phase_stop (clock, phases);
+      if (ctx->yyparse_astree == NULL) {
+         ctx->exitstatus = get_exitstatus();
+         return;
+      }
+      for (size_t file = 0; file < ctx->included_filenames.size();
+            ++file) {
+         add_import (ctx, ctx->included_filenames[file]);
+      }
+   } else {
+      if (not read_source (ctx, &cpp_status)) {
+         ctx->exitstatus = get_exitstatus();
+         return;
+      }
+      ctx->cpp_pipe = fmemopen ((void*) ctx->cpp_output.data(),
+            ctx->cpp_output.size(), "r");
+
+      if (emit & EMIT_TOK) open_tok_file (ctx->prog_name);
+      if (emit & EMIT_ASTB) ctx->intern_log = &interned;
+      scanner_newfilename (ctx->filename.c_str());
+      {
+         lock_guard<mutex> guard (frontend_lock);
+         DEBUGF ('m', "filename = %s, cpp_pipe = %p\n",
+               ctx->filename.c_str(), ctx->cpp_pipe);
+         phase_start (&clock, PHASE_PARSE);
+         parsecode = parse_program (ctx);
+         yylex_destroy();
+         phase_stop (clock, phases);
+      }
+      ctx->intern_log = NULL;
+   }
+   astree* root = ctx->yyparse_astree;
+
+   // Symbol table with struct types
+   SymbolTable *types = new SymbolTable(NULL);
+
+   // Global symbol table
+   SymbolTable *global = new SymbolTable(NULL);
+
+   if (parsecode) {
+      errprintf ("%:parse failed (%d)\n", parsecode);
+   } else {
+      // The dumps are formatted into memory and written by the
+      // background writer while we go on.
+      if (ctx->options->stats_report != REPORT_OFF) {
+         stats_count_nodes (&ctx->stats, root);
+      }
+
+      char* text = NULL;
+      size_t size = 0;
+      phase_start (&clock, PHASE_DUMPS);
+      if (emit & EMIT_ASTB) {
+         FILE *astb_file = open_memstream (&text, &size);
+         astio_write_file (astb_file, root, interned,
+               ctx->included_filenames);
+         fclose (astb_file);
+         write_dump (ctx, ".astb", text, size);
+      }
+      if (emit & EMIT_AST) {
+         FILE *ast_file = open_memstream (&text, &size);
+         dump_astree (ast_file, root);
+         fclose (ast_file);
+         write_dump (ctx, ".ast", text, size);
+      }
+      DEBUGSTMT ('a', dump_astree (stderr, root); );
+      phase_stop (clock, phases);
+
+      // Generate the symbol table and dump to program.sym file
+      phase_start (&clock, PHASE_SYMBOLS);
+      traverse_ast (global, types, root);
+      phase_stop (clock, phases);
+      phase_start (&clock, PHASE_DUMPS);
+      if (emit & EMIT_SYM) {
+         FILE *sym_file = open_memstream (&text, &size);
+         global->dump (sym_file, 0);
+         types->dump (sym_file, 0);
+         fclose (sym_file);
+         write_dump (ctx, ".sym", text, size);
+      }
+      phase_stop (clock, phases);
+
+      // Typecheck program, except for functions whose oil is cached
+      phase_start (&clock, PHASE_TYPECHECK);
+      prepare_oil (root, types, global);
+      typecheck_rec (root, types, global, 0);
+      phase_stop (clock, phases);
+
+      // If typecheck passed, stream the intermediate oil code into
+      // gcc, which compiles it while we finish the remaining dumps.
+      FILE *oil_file = NULL;
+      bool generate = get_exitstatus() == 0;
+      if (generate and (emit & EMIT_BIN)) {
+         clock_gettime (CLOCK_MONOTONIC, &ctx->gcc_start);
+         ctx->gcc_pid = backend_spawn (ctx->prog_name,
+               ctx->options, &oil_file);
+         generate = ctx->gcc_pid > 0;
+      }
+      if (generate and (emit & EMIT_OIL)) {
+         // Without the .oil, gcc is still fed alone.
+         string path = ctx->prog_name + ".oil";
+         FILE* stream = fopen (path.c_str(), "w");
+         if (stream == NULL) {
+            syserrprintf (path.c_str());
+         } else {
+            oil_file = add_oil_stream (oil_file, stream);
+         }
+      }
+      if (generate and not ctx->cache_key.empty()) {
+         oil_file = add_oil_stream (oil_file,
+               open_memstream (&ctx->oil_text, &ctx->oil_size));
+      }
+      if (oil_file != NULL) {
+         phase_start (&clock, PHASE_OIL);
+         generate_oil (oil_file, root, types, global);
+         fclose (oil_file);
+         phase_stop (clock, phases);
+      }
+      if (ctx->gcc_pid > 0 and ctx->options->compile_only) {
+         phase_start (&clock, PHASE_DUMPS);
+         write_interface (ctx, root, types, global);
+         phase_stop (clock, phases);
+      }
+   }
+
+   phase_start (&clock, PHASE_DUMPS);
+   if (emit & EMIT_STR) insert_stringset (ctx);
+   if (cpp_status == 0 and (emit & EMIT_DEP)) write_depfile (ctx);
+   close_tok_file ();
+   phase_stop (clock, phases);
+
+   if (ctx->cpp_pipe != NULL) fclose (ctx->cpp_pipe);
+   ctx->cpp_output.clear();
+   if (cpp_status != 0) {
+      set_exitstatus (EXIT_FAILURE);
+   }
+
+   // Nothing of the front end is needed any more.
+   if (ctx->options->stats_report != REPORT_OFF) {
+      stats_count_strings (&ctx->stats, ctx->strings);
+   }
+   if (root != NULL) free_ast (root);
+   delete global;
+   delete types;
+   ctx->strings.clear();
+
+   ctx->exitstatus = get_exitstatus();
+}
+
+/*
+ * Waits for the back end started by compile_start.
+ */
+void compile_finish (compile_context* ctx) {
+   if (ctx->write_ticket > 0) {
+      phase_clock clock;
+      phase_start (&clock, PHASE_WRITE);
+      writer_wait (ctx->write_ticket);
+      phase_stop (clock, ctx->phases);
+   }
+   if (not ctx->write_error.empty()) {
+      errprintf ("%:%s\n", ctx->write_error.c_str());
+      ctx->exitstatus = max (ctx->exitstatus, EXIT_FAILURE);
+   }
+   if (ctx->gcc_pid > 0) {
+      struct rusage usage;
+      int status = backend_wait (ctx->gcc_pid, &usage);
+      if (status >= 0) {
+         phase_child (PHASE_GCC, ctx->gcc_start, usage, ctx->phases);
+      }
+      if (status != 0) {
+         eprint_status ("gcc", status);
+         ctx->exitstatus = max (ctx->exitstatus, EXIT_FAILURE);
+      }
+   }
+   cache_store (ctx);
+}
+
+/*
+ * Body of each worker thread.  The gcc of one file keeps running
+ * while the worker does the front end of its next file.
+ */
+void compile_worker (work_pool* pool, int worker, void* arg) {
+   vector<compile_context*>* contexts = (vector<compile_context*>*) arg;
+   compile_context* pending = NULL;
+   size_t job;
+   while (pool->next_job (worker, &job)) {
+      compile_context* ctx = (*contexts)[job];
+      DEBUGF ('w', "worker %d compiling %s\n", worker,
+            ctx->filename.c_str());
+      struct timespec started;
+      clock_gettime (CLOCK_MONOTONIC, &started);
+      compile_start (ctx);
+      TRACE_SPAN (TRACE_PHASES, EVENT_COMPILE, started,
+            ctx->filename.c_str());
+      if (pending != NULL) compile_finish (pending);
+      pending = ctx;
+   }
+   if (pending != NULL) compile_finish (pending);
+}
+
+
+/*
+ * Appends the files written for one compilation to artifacts.
+ */
+void list_artifacts (compile_context* ctx, vector<string>* artifacts) {
+   if (ctx->prog_name.empty()) return;
+   unsigned emit = emitted_files (ctx);
+   for (size_t index = 0; index < NEMITTED; ++index) {
+      if (emitted[index].suffix == NULL
+            or not (emit & emitted[index].emit)) continue;
+      string path = ctx->prog_name + emitted[index].suffix;
+      if (access (path.c_str(), F_OK) == 0) artifacts->push_back (path);
+   }
+   if ((ctx->gcc_pid > 0 or ctx->cache_hit)
+         and ctx->exitstatus == EXIT_SUCCESS and (emit & EMIT_BIN)) {
+      if (ctx->options->compile_only) {
+         artifacts->push_back (ctx->prog_name + ".o");
+         artifacts->push_back (ctx->prog_name + ".oi");
+      } else {
+         artifacts->push_back (ctx->prog_name);
+      }
+   }
+}
+
+/*
+ * Returns name as a JSON string.
+ */
+string json_string (const string& name) {
+   string quoted = "\"";
+   for (size_t index = 0; index < name.size(); ++index) {
+      unsigned char ch = name[index];
+      if (ch == '"' or ch == '\\') {
+         quoted += '\\';
+         quoted += ch;
+      } else if (ch < ' ') {
+         char escape[8];
+         snprintf (escape, sizeof escape, "\\u%04x", ch);
+         quoted += escape;
+      } else {
+         quoted += ch;
+      }
+   }
+   return quoted + "\"";
+}
+
+/*
+ * Prints the -T report on stderr, which the server passes on to its
+ * client: the phases of each file, their sum, and what the writer
+ * did meanwhile.
+ */
+void report_phases (const compile_options* options,
+      const vector<compile_context*>& contexts,
+      const phase_times& link, const writer_stats& writes,
+      double wall) {
+   int form = options->phase_report;
+   phase_times total[NPHASES];
+   total[PHASE_LINK] = link;
+   if (form == REPORT_JSON) fprintf (stderr, "{\"files\": [");
+   for (size_t file = 0; file < contexts.size(); ++file) {
+      compile_context* ctx = contexts[file];
+      for (int phase = 0; phase < NPHASES; ++phase) {
+         phase_add (&total[phase], ctx->phases[phase]);
+      }
+      if (form == REPORT_JSON) {
+         fprintf (stderr, "%s\n  {\"file\": %s, \"phases\": {\n",
+               file == 0 ? "" : ",",
+               json_string (ctx->filename).c_str());
+         phase_print (stderr, form, ctx->phases, "    ");
+         fprintf (stderr, "  }}");
+      } else {
+         fprintf (stderr, "%s:\n", ctx->filename.c_str());
+         phase_print (stderr, form, ctx->phases, "   ");
+      }
+   }
+   if (form == REPORT_JSON) {
+      fprintf (stderr, "],\n \"total\": {\n");
+      phase_print (stderr, form, total, "  ");
+      fprintf (stderr, " },\n \"writer\": {\"buffers\": %ld,"
+            " \"bytes\": %zu, \"max_depth\": %zu,"
+            " \"write_seconds\": %.6f, \"wait_seconds\": %.6f},\n"
+            " \"wall\": %.6f}\n", writes.buffers, writes.bytes,
+            writes.max_depth, writes.write_seconds, writes.wait_seconds,
+            wall);
+   } else {
+      fprintf (stderr, "total of %zu files, %.4f s:\n", contexts.size(),
+            wall);
+      phase_print (stderr, form, total, "   ");
+      fprintf (stderr, "writer: %ld buffers, %zu bytes, depth %zu,"
+            " %.4f s writing, %.4f s waiting\n", writes.buffers,
+            writes.bytes, writes.max_depth, writes.write_seconds,
+            writes.wait_seconds);
+   }
+}
+
+/*
+ * Prints the --stats report on stderr: the statistics of each file
+ * and their sum.
+ */
+void report_stats (const compile_options* options,
+      const vector<compile_context*>& contexts) {
+   int form = options->stats_report;
+   compile_stats total;
+   if (form == REPORT_JSON) fprintf (stderr, "{\"files\": [");
+   for (size_t file = 0; file < contexts.size(); ++file) {
+      compile_context* ctx = contexts[file];
+      stats_add (&total, ctx->stats);
+      if (form == REPORT_JSON) {
+         fprintf (stderr, "%s\n  {\"file\": %s,\n",
+               file == 0 ? "" : ",",
+               json_string (ctx->filename).c_str());
+         stats_print (stderr, form, ctx->stats, "   ");
+         fprintf (stderr, "  }");
+      } else {
+         fprintf (stderr, "%s:\n", ctx->filename.c_str());
+         stats_print (stderr, form, ctx->stats, "   ");
+      }
+   }
+   if (form == REPORT_JSON) {
+      fprintf (stderr, "],\n \"total\": {\n");
+      stats_print (stderr, form, total, "  ");
+      fprintf (stderr, " }}\n");
+   } else {
+      fprintf (stderr, "total of %zu files:\n", contexts.size());
+      stats_print (stderr, form, total, "   ");
+   }
+}
+
+/*
+ * Orders the modules of objects so that each comes after the modules
+ * whose interfaces it imports, and otherwise as given, and returns
+ * the functions that run their statements in that order in *inits.
+ * imports has the imports of the modules compiled from source; those
+ * of object files given are not known.  Returns false if modules
+ * import each other.
+ */
+bool order_inits (const vector<string>& objects,
+      const map<string,vector<string>>& imports,
+      vector<string>* inits) {
+   vector<string> modules;
+   for (size_t file = 0; file < objects.size(); ++file) {
+      modules.push_back (base_name (objects[file]));
+   }
+   vector<bool> placed (modules.size(), false);
+   for (size_t count = 0; count < modules.size(); ++count) {
+      size_t ready = 0;
+      for (; ready < modules.size(); ++ready) {
+         if (placed[ready]) continue;
+         map<string,vector<string>>::const_iterator found =
+               imports.find (modules[ready]);
+         if (found == imports.end()) break;
+         const vector<string>& needs = found->second;
+         size_t need = 0;
+         for (; need < needs.size(); ++need) {
+            size_t other = find (modules.begin(), modules.end(),
+                  needs[need]) - modules.begin();
+            if (other < modules.size() and other != ready
+                  and not placed[other]) break;
+         }
+         if (need == needs.size()) break;
+      }
+      if (ready == modules.size()) {
+         string cycle;
+         for (size_t module = 0; module < modules.size(); ++module) {
+            if (not placed[module]) cycle += " " + modules[module];
+         }
+         errprintf ("%:modules import each other:%s\n",
+               cycle.c_str());
+         return false;
+      }
+      DEBUGF ('m', "module %zu: %s\n", count, modules[ready].c_str());
+      placed[ready] = true;
+      inits->push_back (module_init (modules[ready]));
+   }
+   return true;
+}
+
+bool is_object_file (const string& file) {
+   size_t length = file.size();
+   return length > 2 and file.compare (length - 2, 2, ".o") == 0;
+}
+
+int compile_files (const compile_options* options,
+      const vector<string>& filenames, vector<string>* artifacts) {
+   struct timespec started;
+   clock_gettime (CLOCK_MONOTONIC, &started);
+   writer_stats writes_before = writer_get_stats();
+   phase_use_counters (options->counters);
+   if (not options->trace_path.empty()) {
+      trace_start (options->trace_categories);
+   }
+
+   // With -o, sources are compiled as modules and linked with the
+   // objects given into one program.  Their statements run in the
+   // order given, but each module after those it imports.
+   bool link = not options->output.empty();
+   compile_options module_options = *options;
+   if (link) {
+      module_options.compile_only = true;
+      module_options.emit |= EMIT_BIN;
+   }
+   vector<string> sources;
+   vector<string> objects;
+   for (size_t file = 0; file < filenames.size(); ++file) {
+      if (is_object_file (filenames[file])) {
+         objects.push_back (filenames[file]);
+      } else {
+         sources.push_back (filenames[file]);
+         objects.push_back (base_name (filenames[file]) + ".o");
+      }
+   }
+   if (not link and sources.size() < filenames.size()) {
+      errprintf ("%:object files can only be linked with -o\n");
+      return EXIT_FAILURE;
+   }
+
+   // Files are written by the name of the program, without its
+   // directory, so two compilations of the same name would write
+   // the same files at once.  Linked modules also need names of
+   // their own for their statements.
+   map<string,string> names;
+   int name_status = EXIT_SUCCESS;
+   for (size_t file = 0; file < filenames.size(); ++file) {
+      string name = base_name (filenames[file]);
+      if (names.count (name) > 0) {
+         errprintf ("%:%s: same name as %s\n", filenames[file].c_str(),
+               names[name].c_str());
+         name_status = EXIT_FAILURE;
+      } else {
+         names[name] = filenames[file];
+      }
+   }
+   if (name_status != EXIT_SUCCESS) return name_status;
+
+   // Largest files first, so they do not end up as the stragglers.
+   vector<compile_context*> contexts;
+   vector<size_t> weights;
+   for (size_t file = 0; file < sources.size(); ++file) {
+      contexts.push_back (new compile_context (sources[file],
+            &module_options));
+      struct stat info;
+      weights.push_back (stat (sources[file].c_str(), &info) == 0
+            ? info.st_size : 0);
+   }
+
+   int jobs = options->jobs;
+   if (jobs <= 0) jobs = thread::hardware_concurrency();
+   if (jobs <= 0) jobs = 1;
+   if ((size_t) jobs > contexts.size()) jobs = contexts.size();
+
+   int status = EXIT_SUCCESS;
+   if (jobs > 0) {
+      work_pool pool (weights, jobs);
+      pool.run (compile_worker, &contexts);
+   }
+
+   for (size_t file = 0; file < contexts.size(); ++file) {
+      status = max (status, contexts[file]->exitstatus);
+      if (artifacts != NULL) list_artifacts (contexts[file], artifacts);
+   }
+
+   phase_times link_phases[NPHASES];
+   vector<string> inits;
+   if (link and status == EXIT_SUCCESS) {
+      map<string,vector<string>> imports;
+      for (size_t file = 0; file < contexts.size(); ++file) {
+         imports[contexts[file]->prog_name] = contexts[file]->imports;
+      }
+      if (not order_inits (objects, imports, &inits)) {
+         status = EXIT_FAILURE;
+      }
+   }
+   if (link and status == EXIT_SUCCESS) {
+      struct timespec link_start;
+      clock_gettime (CLOCK_MONOTONIC, &link_start);
+      struct rusage usage;
+      int gcc_status = backend_link (options->output, objects, inits,
+            options, &usage);
+      if (gcc_status >= 0) {
+         phase_child (PHASE_LINK, link_start, usage, link_phases);
+      }
+      if (gcc_status != 0) {
+         if (gcc_status > 0) eprint_status ("gcc", gcc_status);
+         status = EXIT_FAILURE;
+      } else if (artifacts != NULL) {
+         artifacts->push_back (options->output);
+      }
+   }
+
+   // The writer serves every request of a server, so only what it
+   // did for this one is reported.  The depth is its deepest ever.
+   writer_stats writes = writer_get_stats();
+   writes.buffers -= writes_before.buffers;
+   writes.bytes -= writes_before.bytes;
+   writes.write_seconds -= writes_before.write_seconds;
+   writes.wait_seconds -= writes_before.wait_seconds;
+   DEBUGF ('w', "writer: %ld buffers, %zu bytes, depth %zu,"
+         " %.3f s writing, %.3f s waiting\n", writes.buffers,
+         writes.bytes, writes.max_depth, writes.write_seconds,
+         writes.wait_seconds);
+   if (options->phase_report != REPORT_OFF) {
+      struct timespec now;
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      report_phases (options, contexts, link_phases[PHASE_LINK], writes,
+            (now.tv_sec - started.tv_sec)
+            + (now.tv_nsec - started.tv_nsec) / 1e9);
+   }
+   if (options->stats_report != REPORT_OFF) {
+      report_stats (options, contexts);
+   }
+   if (not options->trace_path.empty()
+         and not trace_write (options->trace_path)) {
+      status = EXIT_FAILURE;
+   }
+   for (size_t file = 0; file < contexts.size(); ++file) {
+      delete contexts[file];
+   }
+   return status;
+}
@@ -0,0 +1,37 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __COMPILE_H__
+#define __COMPILE_H__
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "context.h"
+
+//
+// DESCRIPTION
+//    Driver of the compiler: option parsing and the compilation of a
+//    list of files on the work pool.  Used by main for a normal run
+//    and by the compile server for each request.
+//
+
+bool scan_opts (int argc, char** argv, compile_options* options,
+      vector<string>* filenames);
+   //
+   // Parses the command line into *options and stores the files to
+   // compile in *filenames.  Prints the usage message and returns
+   // false if there is nothing to do.  May be called more than once
+   // in the same process.
+   //
+
+int compile_files (const compile_options* options,
+      const vector<string>& filenames, vector<string>* artifacts);
+   //
+   // Compiles every file in filenames and returns the worst exit
+   // status of any of them.  If artifacts is not NULL, the names of
+   // the files written, relative to the current directory, are
+   // appended to it.
+   //
+
+#endif
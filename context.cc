@@ -0,0 +1,35 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <string>
+using namespace std;
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "context.h"
+
+static thread_local compile_context* current = NULL;
+
+compile_context::compile_context (const string& filename,
+      const compile_options* options):
+      options (options), filename (filename), exitstatus (EXIT_SUCCESS),
+      cpp_pipe (NULL), gcc_pid (-1), yyparse_astree (NULL),
+      scan_linenr (1), scan_offset (0), scan_echo (false),
+      tok_file (NULL), intern_log (NULL), symtable_n (0),
+      write_ticket (0), cache_hit (false), oil_text (NULL),
+      oil_size (0) {
+   clock_gettime (CLOCK_MONOTONIC, &start_time);
+}
+
+compile_context::~compile_context() {
+   free (oil_text);
+}
+
+compile_context* get_context (void) {
+   assert (current != NULL);
+   return current;
+}
+
+void set_context (compile_context* context) {
+   current = context;
+}
@@ -0,0 +1,154 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __CONTEXT_H__
+#define __CONTEXT_H__
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "phases.h"
+#include "profile.h"
+#include "stats.h"
+#include "stringset.h"
+#include "symtable.h"
+
+//
+// DESCRIPTION
+//    State of a single compilation.  Everything the scanner, the
+//    string set, the symbol tables and oil generation used to keep
+//    in globals lives here instead, so that several files can be
+//    compiled concurrently by the threads of one process.  Each
+//    thread points get_context at the compilation it is working on.
+//
+
+// Files a compilation can write, selected with -e.
+enum {
+   EMIT_TOK = 1 << 0,         // program.tok, every token
+   EMIT_AST = 1 << 1,         // program.ast, the syntax tree
+   EMIT_SYM = 1 << 2,         // program.sym, the symbol tables
+   EMIT_STR = 1 << 3,         // program.str, the string set
+   EMIT_OIL = 1 << 4,         // program.oil, the generated C
+   EMIT_DEP = 1 << 5,         // program.d, the make dependencies
+   EMIT_BIN = 1 << 6,         // The program, or module .o and .oi
+   EMIT_ASTB = 1 << 7,        // program.astb, the tree in binary
+   EMIT_DEFAULT = EMIT_TOK | EMIT_AST | EMIT_SYM | EMIT_STR
+                | EMIT_DEP | EMIT_BIN,
+};
+
+// Options from the command line, shared by all compilations.
+struct compile_options {
+   string dvalue;             // -D option passed on to cpp
+   unsigned emit;             // -e and -k: files to write
+   bool use_gc;               // -G: link the garbage collector
+   bool compile_only;         // -c: write a module object and .oi
+   string output;             // -o: link the modules into output
+   int jobs;                  // -j: number of worker threads
+   bool server;               // --server: run the compile server
+   bool connect;              // --connect: hand the job to a server
+   string socket_path;        // Socket of the server, if not default
+   bool cache_runtime;        // Link runtime objects built once
+   bool cache_stats;          // --cache-stats: report on the cache
+   bool no_prelude;           // --no-prelude: always parse it again
+   int phase_report;          // -T: REPORT_TEXT or REPORT_JSON
+   bool counters;             // --counters: hardware counters for -T
+   string trace_path;         // --trace: Chrome trace to write
+   unsigned trace_categories; // --trace: what to trace
+   int stats_report;          // --stats: REPORT_TEXT or REPORT_JSON
+   bool line_directives;      // --line-directives: #line in the oil
+   bool instrument;           // --instrument: count what runs
+   string profile_use;        // --profile-use: profile to follow
+   string optimize;           // -O: flag of the level for gcc, or ""
+   compile_options(): emit (EMIT_DEFAULT), use_gc (false),
+         compile_only (false), jobs (0),
+         server (false), connect (false), cache_runtime (false),
+         cache_stats (false), no_prelude (false),
+         phase_report (REPORT_OFF), counters (false),
+         trace_categories (0), stats_report (REPORT_OFF),
+         line_directives (false), instrument (false) {}
+};
+
+// Counters and maps used while generating oil.
+struct oil_state {
+   map<string,string> struct_map;   // Maps name to pointer
+   map<string,string> strcon_map;
+   int blocknr;
+   int b_counter;
+   int i_counter;
+   int p_counter;
+   int s_counter;
+   int ifelse_counter;
+   int while_counter;
+   int nstrcons;                    // Number of string constants
+   string strcon_decls;             // Their declarations
+   map<astree*,string> fn_keys;     // Fingerprints of functions
+   map<astree*,string> fn_cached;   // Oil of cached functions
+   string profile_table;            // Counters of this function
+   vector<string> profile_sites;    // And their initializers
+   program_profile profile;         // From --profile-use
+   map<astree*,const function_profile*> fn_profiles;
+   const function_profile* fn_profile;    // Of this function
+   oil_state(): blocknr (1), b_counter (1), i_counter (1),
+         p_counter (1), s_counter (1), ifelse_counter (1),
+         while_counter (1), nstrcons (0), fn_profile (NULL) {}
+};
+
+struct compile_context {
+   const compile_options* options;
+   string filename;           // Path of the .oc file
+   string prog_name;          // Name of program passed
+   int exitstatus;            // Worst status of this compilation
+   FILE* cpp_pipe;            // Output of cpp for the scanner
+   pid_t gcc_pid;             // Back end still running, or -1
+   struct timespec start_time;
+   struct timespec gcc_start;
+   phase_times phases[NPHASES];
+
+   // Scanner and parser
+   astree* yyparse_astree;
+   int scan_linenr;
+   int scan_offset;
+   bool scan_echo;
+   vector<string> included_filenames;
+   vector<string> imports;    // Modules whose interfaces are included
+   FILE* tok_file;
+
+   // String set, symbol tables and oil generation
+   stringset strings;
+   vector<string>* intern_log;   // New strings, while recording
+   int symtable_n;            // Running id number for symbol tables
+   oil_state oil;
+   compile_stats stats;
+
+   // Dumps handed to the background writer
+   long write_ticket;         // Last one queued, or 0
+   string write_error;        // First write that failed
+
+   // Compilation cache
+   string cpp_output;         // Everything cpp wrote
+   string cache_key;          // Hash of the inputs, or empty
+   bool cache_hit;
+   char* oil_text;            // Copy of the oil for the cache
+   size_t oil_size;
+
+   compile_context (const string& filename,
+         const compile_options* options);
+   ~compile_context();
+};
+
+compile_context* get_context (void);
+   //
+   // Returns the compilation the calling thread is working on.
+   //
+
+void set_context (compile_context* context);
+   //
+   // Makes context the compilation of the calling thread.
+   //
+
+#endif
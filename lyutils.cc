@@ -10,91 +10,98 @@ using namespace std;
 #include <stdlib.h>
 #include <string.h>
 
+#include "context.h"
 #include "lyutils.h"
 #include "stringset.h"
 #include "auxlib.h"
 
-astree* yyparse_astree = NULL;
-int scan_linenr = 1;
-int scan_offset = 0;
-bool scan_echo = false;
-vector<string> included_filenames;
-FILE *tok_file = NULL;
-
 // Create a program.tok file
-void open_tok_file (string prog_name) {
-   tok_file = fopen ((prog_name + ".tok").c_str(), "w");
+void open_tok_file (const string& prog_name) {
+   get_context()->tok_file = fopen ((prog_name + ".tok").c_str(), "w");
 }
 
 void close_tok_file (void) {
-   fclose (tok_file);
+   compile_context* ctx = get_context();
+   if (ctx->tok_file != NULL) fclose (ctx->tok_file);
+   ctx->tok_file = NULL;
 }
 
 const string* scanner_filename (int filenr) {
-   return &included_filenames.at(filenr);
+   return &get_context()->included_filenames.at(filenr);
 }
 
 void scanner_newfilename (const char* filename) {
-   included_filenames.push_back (filename);
+   get_context()->included_filenames.push_back (filename);
 }
 
 void scanner_newline (void) {
-   ++scan_linenr;
-   scan_offset = 0;
+   compile_context* ctx = get_context();
+   ++ctx->scan_linenr;
+   ctx->scan_offset = 0;
 }
 
 void scanner_setecho (bool echoflag) {
-   scan_echo = echoflag;
+   get_context()->scan_echo = echoflag;
 }
 
-
+
 void scanner_useraction (void) {
-   if (scan_echo) {
-      if (scan_offset == 0) printf (";%5d: ", scan_linenr);
+   compile_context* ctx = get_context();
+   if (ctx->scan_echo) {
+      if (ctx->scan_offset == 0) printf (";%5d: ", ctx->scan_linenr);
       printf ("%s", yytext);
    }
-   scan_offset += yyleng;
+   ctx->scan_offset += yyleng;
 }
 
 void yyerror (const char* message) {
-   assert (not included_filenames.empty());
+   compile_context* ctx = get_context();
+   assert (not ctx->included_filenames.empty());
    errprintf ("%:%s: %d: %s\n",
-              included_filenames.back().c_str(),
-              scan_linenr, message);
+              ctx->included_filenames.back().c_str(),
+              ctx->scan_linenr, message);
 }
 
 void scanner_badchar (unsigned char bad) {
+   compile_context* ctx = get_context();
    char char_rep[16];
    sprintf (char_rep, isgraph (bad) ? "%c" : "\\%03o", bad);
    errprintf ("%:%s: %d: invalid source character (%s)\n",
-              included_filenames.back().c_str(),
-              scan_linenr, char_rep);
+              ctx->included_filenames.back().c_str(),
+              ctx->scan_linenr, char_rep);
 }
 
 void scanner_badtoken (char* lexeme) {
+   compile_context* ctx = get_context();
    errprintf ("%:%s: %d: invalid token (%s)\n",
-              included_filenames.back().c_str(),
-              scan_linenr, lexeme);
+              ctx->included_filenames.back().c_str(),
+              ctx->scan_linenr, lexeme);
 }
 
 int yylval_token (int symbol) {
-   int offset = scan_offset - yyleng;
-   yylval = new_astree (symbol, included_filenames.size() - 1,
-                        scan_linenr, offset, yytext);
-   fprintf (tok_file, "  %3d  %3d.%03d  %3d  %-13s  %s\n",
-         (int) included_filenames.size() - 1, scan_linenr, offset,
-         symbol, get_yytname (symbol),
-         intern_stringset(yytext)->c_str());
+   compile_context* ctx = get_context();
+   int offset = ctx->scan_offset - yyleng;
+   int filenr = ctx->included_filenames.size() - 1;
+   yylval = new_astree (symbol, filenr, ctx->scan_linenr, offset,
+                        yytext);
+   if (ctx->tok_file != NULL) {
+      fprintf (ctx->tok_file, "  %3d  %3d.%03d  %3d  %-13s  %s\n",
+            filenr, ctx->scan_linenr, offset,
+            symbol, get_yytname (symbol),
+            intern_stringset(yytext)->c_str());
+   }
    return symbol;
 }
 
 astree* new_parseroot (void) {
-   yyparse_astree = new_astree (ROOT, 0, 0, 0, "program");
-   return yyparse_astree;
+   compile_context* ctx = get_context();
+   ctx->yyparse_astree = new_astree (ROOT, 0, 0, 0, "program");
+   return ctx->yyparse_astree;
 }
 
-
+
 void scanner_include (void) {
+   compile_context* ctx = get_context();
    scanner_newline();
    char filename[strlen (yytext) + 1];
    int linenr;
@@ -104,10 +111,13 @@ void scanner_include (void) {
       errprintf ("%: %d: [%s]: invalid directive, ignored\n",
                  scan_rc, yytext);
    }else {
-      fprintf (tok_file, "# %3d \"%s\"\n", linenr, filename);
+      if (ctx->tok_file != NULL) {
+         fprintf (ctx->tok_file, "# %3d \"%s\"\n", linenr, filename);
+      }
       scanner_newfilename (filename);
-      scan_linenr = linenr - 1;
+      ctx->scan_linenr = linenr - 1;
       DEBUGF ('m', "filename=%s, scan_linenr=%d\n",
-              included_filenames.back().c_str(), scan_linenr);
+              ctx->included_filenames.back().c_str(),
+              ctx->scan_linenr);
    }
 }
@@ -13,8 +13,6 @@
 #define YYEOF 0
 
 extern FILE* yyin;
-extern astree* yyparse_astree;
-extern int yyin_linenr;
 extern char* yytext;
 extern int yy_flex_debug;
 extern int yydebug;
@@ -24,10 +22,11 @@ int yylex (void);
 int yyparse (void);
 void yyerror (const char* message);
 int yylex_destroy (void);
+void yyrestart (FILE* input_file);
 const char* get_yytname (int symbol);
 bool is_defined_token (int symbol);
 
-void open_tok_file (string prog_name);
+void open_tok_file (const string& prog_name);
 void close_tok_file (void);
 const string* scanner_filename (int filenr);
 void scanner_newfilename (const char* filename);
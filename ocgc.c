@@ -0,0 +1,296 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+//
+// Conservative mark-sweep garbage collector for the oc runtime.
+// Compiled in place of the pool allocator in oclib.c when the
+// program is built with oc -G, which defines OCLIB_GC.
+//
+// Every word on the C stack, in the callee-saved registers and in
+// the globals registered by the generated oil is treated as a
+// possible pointer into the xcalloc heap.  Small objects live in
+// size-class slabs with a state byte per slot; large objects get a
+// chunk of their own.  A collection runs once the bytes allocated
+// since the last one exceed the threshold, which is the larger of
+// OCLIB_GC_MIN_HEAP bytes and OCLIB_GC_GROWTH percent of the heap
+// that survived the last collection.  Setting OCLIB_ALLOC_STATS
+// prints collection counts and pause times on stderr at exit.
+//
+
+#include <libgen.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define __OCLIB_C__
+#include "oclib.oh"
+
+extern ubyte **oc_argv;
+
+#define SIZE_GRAIN    16
+#define SIZE_CLASSES  16
+#define SLAB_SIZE     0x10000
+
+enum { SLOT_FREE, SLOT_USED, SLOT_MARKED };
+
+struct chunk {
+   char *base;            // first slot
+   char *limit;           // end of the last slot
+   size_t objsize;        // size of every slot
+   size_t nslots;
+   ubyte *state;          // one SLOT_* per slot
+};
+
+struct size_class {
+   char *next;            // bump pointer into the newest slab
+   char *end;
+   struct chunk *slab;    // chunk that next points into
+   void *free_list;       // swept slots, linked through first word
+};
+
+static struct size_class size_classes[SIZE_CLASSES];
+
+// All chunks, sorted by base address for conservative lookup.
+static struct chunk **chunks = NULL;
+static size_t nchunks = 0;
+static size_t chunks_size = 0;
+
+static struct ocgc_root **root_tables = NULL;
+static size_t nroot_tables = 0;
+
+static char *stack_bottom = NULL;
+
+static size_t min_heap = 4 << 20;
+static size_t growth = 100;
+static size_t threshold = 0;
+static size_t allocated = 0;       // bytes since last collection
+static size_t heap_bytes = 0;      // bytes in live slots
+
+static size_t collections = 0;
+static size_t freed_bytes = 0;
+static double total_pause = 0;
+static double max_pause = 0;
+
+static void chunk_insert (struct chunk *chunk) {
+   if (nchunks == chunks_size) {
+      chunks_size = chunks_size == 0 ? 64 : 2 * chunks_size;
+      chunks = realloc (chunks, chunks_size * sizeof *chunks);
+      assert (chunks != NULL);
+   }
+   size_t pos = nchunks;
+   while (pos > 0 && chunks[pos - 1]->base > chunk->base) {
+      chunks[pos] = chunks[pos - 1];
+      --pos;
+   }
+   chunks[pos] = chunk;
+   ++nchunks;
+}
+
+static struct chunk *chunk_find (char *addr) {
+   size_t low = 0;
+   size_t high = nchunks;
+   while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      struct chunk *chunk = chunks[mid];
+      if (addr < chunk->base) high = mid;
+      else if (addr >= chunk->limit) low = mid + 1;
+      else return chunk;
+   }
+   return NULL;
+}
+
+static struct chunk *chunk_new (size_t objsize, size_t nslots) {
+   struct chunk *chunk = malloc (sizeof *chunk);
+   assert (chunk != NULL);
+   chunk->base = calloc (nslots, objsize);
+   assert (chunk->base != NULL);
+   chunk->limit = chunk->base + nslots * objsize;
+   chunk->objsize = objsize;
+   chunk->nslots = nslots;
+   chunk->state = calloc (nslots, 1);
+   assert (chunk->state != NULL);
+   chunk_insert (chunk);
+   return chunk;
+}
+
+//
+// Marking.
+//
+
+static char **mark_stack = NULL;
+static size_t mark_len = 0;
+static size_t mark_size = 0;
+
+static void mark_word (uintptr_t word) {
+   char *addr = (char *) word;
+   struct chunk *chunk = chunk_find (addr);
+   if (chunk == NULL) return;
+   size_t slot = (addr - chunk->base) / chunk->objsize;
+   if (chunk->state[slot] != SLOT_USED) return;
+   chunk->state[slot] = SLOT_MARKED;
+   if (mark_len == mark_size) {
+      mark_size = mark_size == 0 ? 1024 : 2 * mark_size;
+      mark_stack = realloc (mark_stack, mark_size * sizeof *mark_stack);
+      assert (mark_stack != NULL);
+   }
+   mark_stack[mark_len++] = chunk->base + slot * chunk->objsize;
+}
+
+static void mark_range (char *low, char *high) {
+   uintptr_t align = sizeof (uintptr_t) - 1;
+   char *word = (char *) (((uintptr_t) low + align) & ~align);
+   for (; word + sizeof (uintptr_t) <= high;
+        word += sizeof (uintptr_t)) {
+      mark_word (*(uintptr_t *) word);
+   }
+}
+
+static void mark_drain (void) {
+   while (mark_len > 0) {
+      char *object = mark_stack[--mark_len];
+      struct chunk *chunk = chunk_find (object);
+      mark_range (object, object + chunk->objsize);
+   }
+}
+
+static void __attribute__ ((noinline)) mark_stack_roots (void) {
+   // Our own frame is below every frame of the caller, which has
+   // spilled the callee-saved registers, so one sweep from here up
+   // to main covers both the registers and the stack.
+   char *top = __builtin_frame_address (0);
+   mark_range (top, stack_bottom);
+}
+
+static void mark_roots (void) {
+   __builtin_unwind_init();
+   mark_stack_roots();
+   for (size_t table = 0; table < nroot_tables; ++table) {
+      for (struct ocgc_root *root = root_tables[table];
+           root->addr != NULL; ++root) {
+         mark_range (root->addr, (char *) root->addr + root->size);
+      }
+   }
+   mark_drain();
+}
+
+//
+// Sweeping.
+//
+
+static void sweep (void) {
+   size_t live = 0;
+   size_t kept = 0;
+   for (size_t index = 0; index < nchunks; ++index) {
+      struct chunk *chunk = chunks[index];
+      int large = chunk->objsize > SIZE_GRAIN * SIZE_CLASSES;
+      if (large && chunk->state[0] != SLOT_MARKED) {
+         freed_bytes += chunk->objsize;
+         free (chunk->base);
+         free (chunk->state);
+         free (chunk);
+         continue;
+      }
+      struct size_class *sc = NULL;
+      if (! large) sc = &size_classes[chunk->objsize / SIZE_GRAIN - 1];
+      for (size_t slot = 0; slot < chunk->nslots; ++slot) {
+         if (chunk->state[slot] == SLOT_MARKED) {
+            chunk->state[slot] = SLOT_USED;
+            live += chunk->objsize;
+         }else if (chunk->state[slot] == SLOT_USED) {
+            chunk->state[slot] = SLOT_FREE;
+            freed_bytes += chunk->objsize;
+            void **object = (void **) (chunk->base
+                                       + slot * chunk->objsize);
+            *object = sc->free_list;
+            sc->free_list = object;
+         }
+      }
+      chunks[kept++] = chunk;
+   }
+   nchunks = kept;
+   heap_bytes = live;
+}
+
+static double now (void) {
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void collect (void) {
+   double start = now();
+   mark_roots();
+   sweep();
+   double pause = now() - start;
+   ++collections;
+   total_pause += pause;
+   if (pause > max_pause) max_pause = pause;
+   allocated = 0;
+   threshold = heap_bytes * growth / 100;
+   if (threshold < min_heap) threshold = min_heap;
+}
+
+void *xcalloc (int nelem, int size) {
+   size_t bytes = (size_t) nelem * size;
+   if (allocated >= threshold) collect();
+   if (bytes > SIZE_GRAIN * SIZE_CLASSES) {
+      bytes = (bytes + SIZE_GRAIN - 1) / SIZE_GRAIN * SIZE_GRAIN;
+      struct chunk *chunk = chunk_new (bytes, 1);
+      chunk->state[0] = SLOT_USED;
+      allocated += bytes;
+      heap_bytes += bytes;
+      return chunk->base;
+   }
+   size_t index = bytes == 0 ? 0 : (bytes - 1) / SIZE_GRAIN;
+   size_t objsize = (index + 1) * SIZE_GRAIN;
+   struct size_class *sc = &size_classes[index];
+   void *result;
+   if (sc->free_list != NULL) {
+      result = sc->free_list;
+      sc->free_list = *(void **) result;
+      memset (result, 0, objsize);
+   }else {
+      if ((size_t) (sc->end - sc->next) < objsize) {
+         sc->slab = chunk_new (objsize, SLAB_SIZE / objsize);
+         sc->next = sc->slab->base;
+         sc->end = sc->slab->limit;
+      }
+      result = sc->next;
+      sc->next += objsize;
+   }
+   struct chunk *chunk = chunk_find (result);
+   chunk->state[((char *) result - chunk->base) / objsize] = SLOT_USED;
+   allocated += objsize;
+   heap_bytes += objsize;
+   return result;
+}
+
+void ocgc_add_roots (struct ocgc_root *roots) {
+   root_tables = realloc (root_tables,
+                          (nroot_tables + 1) * sizeof *root_tables);
+   assert (root_tables != NULL);
+   root_tables[nroot_tables++] = roots;
+}
+
+static void gc_stats (void) {
+   fprintf (stderr, "%s: garbage collection statistics\n",
+            basename ((char *) oc_argv[0]));
+   fprintf (stderr, "%14s %14zu\n", "collections", collections);
+   fprintf (stderr, "%14s %14zu\n", "live bytes", heap_bytes);
+   fprintf (stderr, "%14s %14zu\n", "freed bytes", freed_bytes);
+   fprintf (stderr, "%14s %14zu\n", "chunks", nchunks);
+   fprintf (stderr, "%14s %14.3f ms\n", "total pause",
+            total_pause * 1e3);
+   fprintf (stderr, "%14s %14.3f ms\n", "max pause", max_pause * 1e3);
+}
+
+void ocgc_init (void *bottom) {
+   stack_bottom = bottom;
+   const char *env = getenv ("OCLIB_GC_MIN_HEAP");
+   if (env != NULL) min_heap = strtoul (env, NULL, 0);
+   env = getenv ("OCLIB_GC_GROWTH");
+   if (env != NULL) growth = strtoul (env, NULL, 0);
+   threshold = min_heap;
+   if (getenv ("OCLIB_ALLOC_STATS") != NULL) atexit (gc_stats);
+}
@@ -1,17 +1,81 @@
 // $Id: oclib.c,v 1.45 2012-11-16 21:10:41-08 - - $
 
 #include <ctype.h>
+#include <errno.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #define __OCLIB_C__
 #include "oclib.oh"
 
 ubyte **oc_argv;
 
+//
+// Output is collected in a runtime buffer and written with write(2).
+// The buffer is flushed at every newline only when stdout is a
+// terminal, and when full otherwise.  Setting OCLIB_STDOUT to "line"
+// or "block" overrides that choice.  It is always flushed at exit
+// and before an assertion failure aborts.
+//
+
+#define OUTBUF_SIZE  0x10000
+
+static ubyte outbuf[OUTBUF_SIZE];
+static size_t out_len = 0;
+static int out_linebuf = 0;
+
+static void out_flush (void) {
+   ubyte *next = outbuf;
+   while (out_len > 0) {
+      ssize_t count = write (STDOUT_FILENO, next, out_len);
+      if (count < 0) {
+         if (errno == EINTR) continue;
+         break;
+      }
+      next += count;
+      out_len -= count;
+   }
+   out_len = 0;
+}
+
+static void out_write (const ubyte *str, size_t len) {
+   if (len > OUTBUF_SIZE - out_len) {
+      out_flush();
+      if (len > OUTBUF_SIZE) {
+         // Too big to be worth copying; write it straight through.
+         while (len > 0) {
+            ssize_t count = write (STDOUT_FILENO, str, len);
+            if (count < 0) {
+               if (errno == EINTR) continue;
+               break;
+            }
+            str += count;
+            len -= count;
+         }
+         return;
+      }
+   }
+   memcpy (outbuf + out_len, str, len);
+   out_len += len;
+}
+
+static void out_init (void) {
+   const char *mode = getenv ("OCLIB_STDOUT");
+   if (mode != NULL && strcmp (mode, "line") == 0) {
+      out_linebuf = 1;
+   }else if (mode != NULL && strcmp (mode, "block") == 0) {
+      out_linebuf = 0;
+   }else {
+      out_linebuf = isatty (STDOUT_FILENO);
+   }
+   atexit (out_flush);
+}
+
 void ____assert_fail (char *expr, char *file, int line) {
+   out_flush();
    fflush (NULL);
    fprintf (stderr, "%s: %s:%d: assert (%s) failed.\n",
             basename ((char *) oc_argv[0]), file, line, expr);
@@ -19,48 +83,287 @@ void ____assert_fail (char *expr, char *file, int line) {
    abort();
 }
 
+#ifndef OCLIB_GC
+
+//
+// Small objects, which is what new on a struct produces, are served
+// from size-class slabs by bumping a pointer, since oc never frees
+// anything.  Requests bigger than the largest class, typically
+// arrays, pass straight through to calloc.  Setting
+// OCLIB_ALLOC_STATS prints a summary on stderr at exit.
+//
+
+#define SIZE_GRAIN    16
+#define SIZE_CLASSES  16
+#define SLAB_SIZE     0x10000
+
+struct size_class {
+   char *next;
+   char *end;
+   size_t objects;
+   size_t slabs;
+};
+
+static struct size_class size_classes[SIZE_CLASSES];
+static size_t large_objects = 0;
+static size_t large_bytes = 0;
+
 void *xcalloc (int nelem, int size) {
-   void *result = calloc (nelem, size);
-   assert (result != NULL);
+   size_t bytes = (size_t) nelem * size;
+   if (bytes > SIZE_GRAIN * SIZE_CLASSES) {
+      void *result = calloc (nelem, size);
+      assert (result != NULL);
+      ++large_objects;
+      large_bytes += bytes;
+      return result;
+   }
+   size_t index = bytes == 0 ? 0 : (bytes - 1) / SIZE_GRAIN;
+   size_t objsize = (index + 1) * SIZE_GRAIN;
+   struct size_class *sc = &size_classes[index];
+   if ((size_t) (sc->end - sc->next) < objsize) {
+      // Slabs come from calloc, so objects are already zeroed.
+      sc->next = calloc (1, SLAB_SIZE);
+      assert (sc->next != NULL);
+      sc->end = sc->next + SLAB_SIZE;
+      ++sc->slabs;
+   }
+   void *result = sc->next;
+   sc->next += objsize;
+   ++sc->objects;
    return result;
 }
 
+static void alloc_stats (void) {
+   size_t objects = large_objects;
+   size_t bytes = large_bytes;
+   fprintf (stderr, "%s: allocation statistics\n",
+            basename ((char *) oc_argv[0]));
+   fprintf (stderr, "%8s %12s %8s %14s\n",
+            "class", "objects", "slabs", "bytes");
+   for (size_t index = 0; index < SIZE_CLASSES; ++index) {
+      struct size_class *sc = &size_classes[index];
+      if (sc->slabs == 0) continue;
+      size_t objsize = (index + 1) * SIZE_GRAIN;
+      fprintf (stderr, "%8zu %12zu %8zu %14zu\n", objsize,
+               sc->objects, sc->slabs, sc->objects * objsize);
+      objects += sc->objects;
+      bytes += sc->objects * objsize;
+   }
+   fprintf (stderr, "%8s %12zu %8s %14zu\n", "large",
+            large_objects, "-", large_bytes);
+   fprintf (stderr, "%8s %12zu %8s %14zu\n", "total",
+            objects, "-", bytes);
+}
+
+#endif
+
+//
+// Programs built with oc --instrument count the entries into each
+// function and the times each label of its ifs and whiles is
+// reached.  Every module registers its counters, and at exit they
+// are written to the file named by OCLIB_PROFILE, or else to
+// program.ocprof, one line for each function and then one for each
+// of its sites:
+//
+//    function name fingerprint entries file:line
+//    site kind label count file:line
+//
+
+static struct ocprof_function ***profile_tables = NULL;
+static size_t nprofile_tables = 0;
+
+static void profile_write (void) {
+   char name[4096];
+   const char *path = getenv ("OCLIB_PROFILE");
+   if (path == NULL) {
+      snprintf (name, sizeof name, "%s.ocprof",
+                basename ((char *) oc_argv[0]));
+      path = name;
+   }
+   FILE *out = fopen (path, "w");
+   if (out == NULL) {
+      fprintf (stderr, "%s: %s: %s\n", basename ((char *) oc_argv[0]),
+               path, strerror (errno));
+      return;
+   }
+   fprintf (out, "ocprof 1\n");
+   for (size_t table = 0; table < nprofile_tables; ++table) {
+      struct ocprof_function **function = profile_tables[table];
+      for (; *function != NULL; ++function) {
+         struct ocprof_site *site = (*function)->sites;
+         fprintf (out, "function %s %s %lu %s:%d\n", (*function)->name,
+                  (*function)->fingerprint, site->count,
+                  (*function)->file, (*function)->line);
+         for (++site; site->kind != NULL; ++site) {
+            fprintf (out, "site %s %d %lu %s:%d\n", site->kind,
+                     site->label, site->count, site->file, site->line);
+         }
+      }
+   }
+   fclose (out);
+}
+
+void ocprof_add_functions (struct ocprof_function **functions) {
+   if (nprofile_tables == 0) atexit (profile_write);
+   profile_tables = realloc (profile_tables,
+                             (nprofile_tables + 1)
+                             * sizeof *profile_tables);
+   assert (profile_tables != NULL);
+   profile_tables[nprofile_tables++] = functions;
+}
+
 void __ocmain (void);
 int main (int argc, char **argv) {
    argc = argc; // warning: unused parameter 'argc'
    oc_argv = (ubyte **) argv;
+   out_init();
+#ifdef OCLIB_GC
+   ocgc_init (__builtin_frame_address (0));
+#else
+   if (getenv ("OCLIB_ALLOC_STATS") != NULL) atexit (alloc_stats);
+#endif
    __ocmain();
    return EXIT_SUCCESS;
 }
 
 
+//
+// Input is read from stdin in large blocks with read(2) and handed
+// out a character at a time without any stdio locking.  Strings
+// returned by scan are carved out of a string arena instead of being
+// malloc'ed one at a time, since oc never frees them anyway.
+//
+
+#define INBUF_SIZE   0x10000
+#define ARENA_CHUNK  0x10000
+
+static ubyte inbuf[INBUF_SIZE];
+static ubyte *in_next = inbuf;
+static ubyte *in_end = inbuf;
+
+static size_t in_refill (void) {
+   ssize_t count;
+   // Make sure an interactive user sees any prompt before we block.
+   if (out_linebuf) out_flush();
+   do count = read (STDIN_FILENO, inbuf, sizeof inbuf);
+   while (count < 0 && errno == EINTR);
+   if (count < 0) count = 0;
+   in_next = inbuf;
+   in_end = inbuf + count;
+   return count;
+}
+
+#define in_getc() \
+        (in_next < in_end || in_refill() ? *in_next++ : EOF)
+
+static ubyte *arena_next = NULL;
+static ubyte *arena_end = NULL;
+
+static ubyte *arena_strndup (ubyte *str, size_t len) {
+   ubyte *result;
+   if (len + 1 > (size_t) (arena_end - arena_next)) {
+      if (len + 1 > ARENA_CHUNK / 4) {
+         // Long strings get their own block rather than wasting
+         // the tail of the current chunk.
+         result = malloc (len + 1);
+         assert (result != NULL);
+         memcpy (result, str, len);
+         result[len] = '\0';
+         return result;
+      }
+      arena_next = malloc (ARENA_CHUNK);
+      assert (arena_next != NULL);
+      arena_end = arena_next + ARENA_CHUNK;
+   }
+   result = arena_next;
+   memcpy (result, str, len);
+   result[len] = '\0';
+   arena_next += len + 1;
+   return result;
+}
+
+// Holds words and lines that straddle a refill of the input buffer.
+static ubyte *scratch = NULL;
+static size_t scratch_size = 0;
+static size_t scratch_len = 0;
+
+static void scratch_append (ubyte *str, size_t len) {
+   if (scratch_len + len > scratch_size) {
+      while (scratch_len + len > scratch_size) {
+         scratch_size = scratch_size == 0 ? INBUF_SIZE
+                                          : 2 * scratch_size;
+      }
+      scratch = realloc (scratch, scratch_size);
+      assert (scratch != NULL);
+   }
+   memcpy (scratch + scratch_len, str, len);
+   scratch_len += len;
+}
+
 ubyte *scan (int (*skipover) (int), int (*stopat) (int)) {
    int byte;
    do {
-      byte = getchar();
+      byte = in_getc();
       if (byte == EOF) return NULL;
    } while (skipover (byte));
-   ubyte buffer[0x1000];
-   ubyte *end = buffer;
-   do {
-      *end++ = byte;
-      assert (end < buffer + sizeof buffer);
-      *end = '\0';
-      byte = getchar();
-   }while (byte != EOF && ! stopat (byte));
-   ubyte *result = (ubyte *) strdup ((char *) buffer);
-   assert (result != NULL);
-   return result;
+   ubyte *start = in_next - 1;
+   scratch_len = 0;
+   for (;;) {
+      ubyte *stop = in_next;
+      while (stop < in_end && ! stopat (*stop)) ++stop;
+      if (stop < in_end) {
+         // Found the terminator, which is consumed but not returned.
+         in_next = stop + 1;
+         if (scratch_len == 0) {
+            return arena_strndup (start, stop - start);
+         }
+         scratch_append (start, stop - start);
+         break;
+      }
+      scratch_append (start, stop - start);
+      if (in_refill() == 0) break;
+      start = in_next;
+   }
+   return arena_strndup (scratch, scratch_len);
 }
 
 int isfalse (int byte)   { return 0 & byte; } 
 int isnl (int byte)      { return byte == '\n'; }
-void __putb (ubyte byte) { printf ("%s", byte ? "true" : "false"); } 
-void __putc (ubyte byte) { printf ("%c", byte); } 
-void __puti (int val)    { printf ("%d", val); }
-void __puts (ubyte *str) { printf ("%s", str); }
-void __endl (void)       { printf ("%c", '\n'); fflush (NULL); }
-int __getc (void)        { return getchar(); } 
+
+void __puti (int val) {
+   // Format right to left; the magnitude is unsigned so that
+   // INT_MIN does not overflow.
+   ubyte digits[16];
+   ubyte *end = digits + sizeof digits;
+   ubyte *start = end;
+   unsigned int mag = val < 0 ? - (unsigned int) val
+                              : (unsigned int) val;
+   do {
+      *--start = '0' + mag % 10;
+      mag /= 10;
+   } while (mag != 0);
+   if (val < 0) *--start = '-';
+   out_write (start, end - start);
+}
+
+void __putb (ubyte byte) {
+   if (byte) out_write ((ubyte *) "true", 4);
+        else out_write ((ubyte *) "false", 5);
+}
+
+void __putc (ubyte byte) {
+   if (out_len == OUTBUF_SIZE) out_flush();
+   outbuf[out_len++] = byte;
+}
+
+void __puts (ubyte *str) { out_write (str, strlen ((char *) str)); }
+
+void __endl (void) {
+   __putc ('\n');
+   if (out_linebuf) out_flush();
+}
+
+int __getc (void)        { return in_getc(); }
 ubyte *__getw (void)     { return scan (isspace, isspace); }
 ubyte *__getln (void)    { return scan (isfalse, isnl); } 
 ubyte **__getargv (void) { return oc_argv; }
@@ -1,7 +1,10 @@
 // Paul Scherer, pscherer@ucsc.edu
 
+#include <algorithm>
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <set>
 #include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,24 +13,26 @@
 
 #include "astree.h"
 #include "auxlib.h"
+#include "cache.h"
+#include "context.h"
 #include "lyutils.h"
+#include "profile.h"
 #include "symtable.h"
 #include "typecheck.h"
 
 const int INDENT = 8;
-// Maps name to pointer
-map<string,string> struct_map;
-map<string,string> strcon_map;
-int blocknr = 1;
-int b_counter = 1;
-int i_counter = 1;
-int p_counter = 1;
-int s_counter = 1;
-int ifelse_counter = 1;
-int while_counter = 1;
+
+// A frequent function without loops of at most this many nodes is
+// declared inline.
+const size_t INLINE_NODES = 64;
 
 enum Category { GLOBAL, LOCAL, STRUCT, FIELD };
 
+// Counters and maps of the current compilation
+static oil_state& oil (void) {
+   return get_context()->oil;
+}
+
 string oil_expr (FILE* outfile, astree* node, SymbolTable* types,
       SymbolTable* global, int category, int depth);
 
@@ -38,37 +43,42 @@ string reg_category (string type) {
    // Convert the variable counter to a string
    std::ostringstream ostr;
    string var_count = ostr.str();
+   long* temporaries = get_context()->stats.temporaries;
    if (strcmp (type.c_str(), "int") == 0) {
-      ostr << i_counter;
+      ++temporaries[REGISTER_INT];
+      ostr << oil().i_counter;
       string reg = "i" + ostr.str();
-      i_counter++;
+      oil().i_counter++;
       return reg;
    }
 
    if (strcmp (type.c_str(), "ubyte") == 0) {
-      ostr << b_counter;
+      ++temporaries[REGISTER_UBYTE];
+      ostr << oil().b_counter;
       string reg = "b" + ostr.str();
-      b_counter++;
+      oil().b_counter++;
       return reg;
    }
 
    if (type.find ("*") != std::string::npos ||
          type.find ("[") != std::string::npos) {
-      ostr << p_counter;
+      ++temporaries[REGISTER_POINTER];
+      ostr << oil().p_counter;
       string reg = "p" + ostr.str();
-      p_counter++;
+      oil().p_counter++;
       return reg;
    }
 
-   ostr << s_counter;
+   ++temporaries[REGISTER_STRING];
+   ostr << oil().s_counter;
    string reg = "s" + ostr.str();
-   s_counter++;
+   oil().s_counter++;
    return reg;
 }
 
 string convert_ident (string name, string field_name, int category) {
    std::ostringstream ostr;
-   ostr << blocknr;
+   ostr << oil().blocknr;
    string blocknumber = ostr.str();
    string new_ident = "";
    switch (category) {
@@ -175,6 +185,150 @@ bool is_struct (string name, SymbolTable* types) {
    return false;
 }
 
+/*
+ * Returns the C type for an oc type.
+ */
+string c_type (string type, SymbolTable* types) {
+   if (is_struct (type, types)) {
+      return "struct " + converted_type (type);
+   }
+   return converted_type (type);
+}
+
+/*
+ * Tells whether node was read from the interface (.oi) of another
+ * module.  Its declarations are defined by that module.
+ */
+bool is_imported (astree* node) {
+   const string* filename = scanner_filename (node->filenr);
+   size_t length = filename->size();
+   return length > 3 and filename->compare (length - 3, 3, ".oi") == 0;
+}
+
+/*
+ * Returns text as a C string constant.
+ */
+string c_string (const string& text) {
+   string quoted = "\"";
+   for (size_t index = 0; index < text.size(); ++index) {
+      if (text[index] == '"' or text[index] == '\\') quoted += '\\';
+      quoted += text[index];
+   }
+   return quoted + "\"";
+}
+
+/*
+ * With --line-directives, prints a #line directive that gives the
+ * oc file and line of node to what follows, so that gcc, debuggers
+ * and profilers name the oc source instead of the oil.
+ */
+void print_line (FILE* outfile, const string& filename, size_t linenr) {
+   if (not get_context()->options->line_directives) return;
+   fprintf (outfile, "#line %zu %s\n", linenr,
+         c_string (filename).c_str());
+}
+
+void print_line (FILE* outfile, astree* node) {
+   print_line (outfile, *scanner_filename (node->filenr), node->linenr);
+}
+
+/*
+ * With --instrument, counts the times the program gets here, as the
+ * site kind numbered label of the function being generated.  The
+ * site is known by the oc file and line it was generated from.
+ */
+void count_site (FILE* outfile, const char* kind, int label,
+      const string& filename, size_t linenr, int depth) {
+   if (not get_context()->options->instrument) return;
+   vector<string>& sites = oil().profile_sites;
+   fprintf (outfile, "%*s++%s[%zu].count;\n", depth * INDENT, "",
+         oil().profile_table.c_str(), sites.size());
+   sites.push_back (string ("{\"") + kind + "\", "
+         + to_string (label) + ", " + c_string (filename) + ", "
+         + to_string (linenr) + ", 0}");
+}
+
+void count_site (FILE* outfile, const char* kind, int label,
+      astree* node, int depth) {
+   count_site (outfile, kind, label, *scanner_filename (node->filenr),
+         node->linenr, depth);
+}
+
+/*
+ * With --instrument, returns the counters of the function just
+ * generated, named oil_name in the oil and name in the profile, and
+ * the record that registers them with the runtime.  The first
+ * counter is that of the entry.
+ */
+string profile_table (const string& oil_name, const string& name,
+      const vector<astree*>& trees, const string& filename,
+      size_t linenr) {
+   if (not get_context()->options->instrument) return "";
+   const vector<string>& sites = oil().profile_sites;
+   string table = "\nstatic struct ocprof_site " + oil().profile_table
+         + "[] = {\n";
+   for (size_t site = 0; site < sites.size(); ++site) {
+      table += string (INDENT, ' ') + sites[site] + ",\n";
+   }
+   table += string (INDENT, ' ') + "{0, 0, 0, 0, 0}\n};\n";
+   table += "static struct ocprof_function ocprof" + oil_name
+         + " = {\n" + string (INDENT, ' ') + c_string (name) + ", "
+         + c_string (tree_fingerprint (trees)) + ", "
+         + c_string (filename) + ", " + to_string (linenr) + ",\n"
+         + string (INDENT, ' ') + oil().profile_table + "\n};\n";
+   return table;
+}
+
+/*
+ * Returns the profile of function, or NULL if it has none.
+ */
+const function_profile* profile_of (astree* function) {
+   map<astree*,const function_profile*>::iterator profile =
+         oil().fn_profiles.find (function);
+   return profile == oil().fn_profiles.end() ? NULL : profile->second;
+}
+
+/*
+ * Returns condition, the condition of the jump to label kind_label,
+ * telling gcc which way it goes if the profile knows.
+ */
+string expect_jump (const string& condition, const char* kind,
+      int label) {
+   int expected = profile_jump (oil().fn_profile, kind, label);
+   if (expected < 0) return condition;
+   return "__builtin_expect (" + condition + ", "
+         + to_string (expected) + ")";
+}
+
+size_t tree_size (astree* root) {
+   size_t size = 1;
+   for (size_t child = 0; child < root->children.size(); ++child) {
+      size += tree_size (root->children[child]);
+   }
+   return size;
+}
+
+/*
+ * Returns the attributes the profile calls for on function: hot or
+ * cold, and inline for one called often that is small and has no
+ * loop.
+ */
+string function_attributes (astree* function) {
+   const function_profile* profile = oil().fn_profile;
+   if (profile == NULL) return "";
+   if (profile->cold) return "__attribute__ ((cold, noinline))\n";
+   string attributes = profile->hot ? "__attribute__ ((hot))\n" : "";
+   if (profile->frequent and not profile->loops
+         and tree_size (function) <= INLINE_NODES) {
+      attributes += "inline ";
+   }
+   return attributes;
+}
+
+bool is_symbol (astree* node, const char* symbol) {
+   return strcmp ((char *)get_yytname (node->symbol), symbol) == 0;
+}
+
 /*
  * Returns the lexical constant passed.
  */
@@ -190,8 +344,8 @@ string oil_constant (astree* node) {
       return "0";
 
    if (strcmp (symbol.c_str(), "TOK_STRCON") == 0) {
-      if (strcon_map.count(constant->lexinfo->c_str()) > 0) {
-         return strcon_map[constant->lexinfo->c_str()];
+      if (oil().strcon_map.count(constant->lexinfo->c_str()) > 0) {
+         return oil().strcon_map[constant->lexinfo->c_str()];
       }
    }
 
@@ -496,6 +650,11 @@ void traverse_oil (FILE* outfile, astree* root, SymbolTable* types,
    int cmp_return = strcmp ((char *)get_yytname (root->symbol),
          "TOK_RETURN") == 0;
 
+   if (cmp_vardecl or cmp_binop or cmp_call or cmp_while or cmp_if
+         or cmp_ifelse or cmp_return) {
+      print_line (outfile, root);
+   }
+
    if (cmp_vardecl) {
       astree* alloc = root->children[2];
       int cmp_alloc = strcmp ((char *)get_yytname (alloc->symbol),
@@ -522,7 +681,7 @@ void traverse_oil (FILE* outfile, astree* root, SymbolTable* types,
          }
 
          // Map the variable name to the created struct pointer
-         struct_map[name] = expr;
+         oil().struct_map[name] = expr;
       } else if (cmp_newarray) {
          if (alloc->children.size() == 2) {
             fprintf (outfile, "%*s%s = %s;\n", depth * INDENT, "",
@@ -544,13 +703,16 @@ void traverse_oil (FILE* outfile, astree* root, SymbolTable* types,
                global, depth, LOCAL);
       }
    } else if (cmp_if) {
-      int local_counter = ifelse_counter;
+      int local_counter = oil().ifelse_counter++;
       string expr = oil_expr (outfile, root->children[0],
             types, global, category, depth);
 
       expr = convert_expr(expr, global);
-      fprintf (outfile, "%*sif (!%s) goto fi_%d;\n",
-            (depth) * INDENT, "", expr.c_str(), ifelse_counter++);
+      fprintf (outfile, "%*sif (%s) goto fi_%d;\n",
+            (depth) * INDENT, "",
+            expect_jump ("!" + expr, "fi", local_counter).c_str(),
+            local_counter);
+      count_site (outfile, "then", local_counter, root, depth);
 
       if (global->enter_block (root->blockNum) != NULL) {
          global = global->enter_block(root->blockNum);
@@ -567,16 +729,21 @@ void traverse_oil (FILE* outfile, astree* root, SymbolTable* types,
          global = global->getParent();
       }
 
+      print_line (outfile, root);
       fprintf (outfile, "%*sfi_%d:;\n",
             (depth - 1) * INDENT, "", local_counter);
+      count_site (outfile, "fi", local_counter, root, depth);
    } else if (cmp_ifelse) {
-      int local_counter = ifelse_counter;
+      int local_counter = oil().ifelse_counter++;
       string expr = oil_expr (outfile, root->children[0],
             types, global, category, depth);
 
       expr = convert_expr(expr, global);
-      fprintf (outfile, "%*sif (!%s) goto else_%d;\n",
-            (depth) * INDENT, "", expr.c_str(), ifelse_counter++);
+      fprintf (outfile, "%*sif (%s) goto else_%d;\n",
+            (depth) * INDENT, "",
+            expect_jump ("!" + expr, "else", local_counter).c_str(),
+            local_counter);
+      count_site (outfile, "then", local_counter, root, depth);
 
       if (global->enter_block (root->blockNum) != NULL) {
          global = global->enter_block(root->blockNum);
@@ -589,10 +756,12 @@ void traverse_oil (FILE* outfile, astree* root, SymbolTable* types,
                global, depth, LOCAL);
       }
 
+      print_line (outfile, root);
       fprintf (outfile, "%*sgoto fi_%d;\n",
             (depth) * INDENT, "", local_counter);
       fprintf (outfile, "%*selse_%d:;\n",
             (depth - 1) * INDENT, "", local_counter);
+      count_site (outfile, "else", local_counter, root, depth);
 
       astree* else_stmt = root->children[last_stmt];
       if (global->enter_block (else_stmt->blockNum) != NULL) {
@@ -605,19 +774,24 @@ void traverse_oil (FILE* outfile, astree* root, SymbolTable* types,
          global = global->getParent();
       }
 
+      print_line (outfile, root);
       fprintf (outfile, "%*sfi_%d:;\n",
             (depth - 1) * INDENT, "", local_counter);
+      count_site (outfile, "fi", local_counter, root, depth);
    } else if (cmp_while) {
-      int local_counter = while_counter++;
+      int local_counter = oil().while_counter++;
       fprintf (outfile, "%*swhile_%d:;\n",
             (depth - 1) * INDENT, "", local_counter);
+      count_site (outfile, "while", local_counter, root, depth);
 
       string expr = oil_expr (outfile, root->children[0],
             types, global, category, depth);
       expr = convert_expr (expr, global);
 
-      fprintf (outfile, "%*sif (!%s) goto break_%d;\n",
-            depth * INDENT, "", expr.c_str(), local_counter);
+      fprintf (outfile, "%*sif (%s) goto break_%d;\n",
+            depth * INDENT, "",
+            expect_jump ("!" + expr, "break", local_counter).c_str(),
+            local_counter);
 
       if (global->enter_block (root->blockNum) != NULL) {
          global = global->enter_block(root->blockNum);
@@ -635,10 +809,12 @@ void traverse_oil (FILE* outfile, astree* root, SymbolTable* types,
          global = global->getParent();
       }
 
+      print_line (outfile, root);
       fprintf (outfile, "%*sgoto while_%d;\n",
             (depth) * INDENT, "", local_counter);
       fprintf (outfile, "%*sbreak_%d:;\n",
             (depth - 1) * INDENT, "", local_counter);
+      count_site (outfile, "break", local_counter, root, depth);
    } else if (cmp_binop) {
       astree* binop_sym = root->children[1];
       astree* expr1node = root->children[0];
@@ -683,11 +859,29 @@ void traverse_ast (FILE* outfile, astree* root, SymbolTable* types,
       SymbolTable* global, int depth, int category) {
    for (size_t child = 0; child < root->children.size();
          ++child) {
+      if (is_imported (root->children[child])) continue;
       traverse_oil (outfile, root->children[child], types, global,
             depth, category);
    }
 }
 
+/*
+ * Restarts the numbering of temporaries and labels, which are local
+ * to each function.  Numbering every function from the same start
+ * keeps its oil independent of the functions before it, so that its
+ * cached oil can be used again.  String constants are global and
+ * keep their registers.
+ */
+void reset_counters (void) {
+   oil().i_counter = 1;
+   oil().b_counter = 1;
+   oil().p_counter = 1;
+   oil().s_counter = oil().nstrcons + 1;
+   oil().ifelse_counter = 1;
+   oil().while_counter = 1;
+   oil().profile_sites.clear();
+}
+
 void generate_oil_func (FILE* outfile, astree* root, SymbolTable* types,
       SymbolTable* global, int depth) {
    if (root == NULL) return;
@@ -700,20 +894,45 @@ void generate_oil_func (FILE* outfile, astree* root, SymbolTable* types,
 
    if (strcmp ((char *)get_yytname (root->symbol),
          "TOK_FUNCTION") == 0) {
+      map<astree*,string>::iterator cached =
+            oil().fn_cached.find (root);
+      if (cached != oil().fn_cached.end()) {
+         fputs (cached->second.c_str(), outfile);
+         return;
+      }
+
+      // A function that can be cached is generated into memory
+      // first, so that its oil can be stored as well.  So is one
+      // with counters, which must be declared before it.
+      map<astree*,string>::iterator key = oil().fn_keys.find (root);
+      FILE* func_file = outfile;
+      char* func_text = NULL;
+      size_t func_size = 0;
+      if (key != oil().fn_keys.end()
+            or get_context()->options->instrument) {
+         func_file = open_memstream (&func_text, &func_size);
+      }
+      reset_counters();
+
       int name_index = 1;
       int block_index = 2;
 
       string func_name = root->children[name_index]->lexinfo->
             c_str();
+      oil().profile_table = "ocprof_sites__" + func_name;
+      oil().fn_profile = profile_of (root);
       string func_type = global->lookup(func_name, root->linenr);
 
       vector<string> signature = global->parseSignature(func_type);
 
+      fprintf (func_file, "\n");
+      print_line (func_file, root);
+      fputs (function_attributes (root).c_str(), func_file);
       if (is_struct (signature[0], types)) {
-         fprintf (outfile, "\nstruct %s\n__%s(\n",
+         fprintf (func_file, "struct %s\n__%s(\n",
                signature[0].c_str(), func_name.c_str());
       } else {
-         fprintf (outfile, "\n%s\n__%s(\n", signature[0].c_str(),
+         fprintf (func_file, "%s\n__%s(\n", signature[0].c_str(),
                func_name.c_str());
       }
 
@@ -730,12 +949,12 @@ void generate_oil_func (FILE* outfile, astree* root, SymbolTable* types,
                   children[1];
 
             if (is_struct (signature[size], types)) {
-               fprintf (outfile, "%*sstruct %s %s", INDENT, "",
+               fprintf (func_file, "%*sstruct %s %s", INDENT, "",
                      converted_type (signature[size]).c_str(),
                      convert_ident (declid->lexinfo->c_str(), "",
                            LOCAL).c_str());
             } else {
-               fprintf (outfile, "%*s%s %s", INDENT, "",
+               fprintf (func_file, "%*s%s %s", INDENT, "",
                      converted_type (signature[size]).c_str(),
                      convert_ident (declid->lexinfo->c_str(), "",
                            LOCAL).c_str());
@@ -743,25 +962,160 @@ void generate_oil_func (FILE* outfile, astree* root, SymbolTable* types,
 
             // If last parameter
             if (size + 1 == signature.size()) {
-               fprintf (outfile, ")\n");
+               fprintf (func_file, ")\n");
             } else {
-               fprintf (outfile, ",\n");
+               fprintf (func_file, ",\n");
             }
          }
       } else {
-         fprintf (outfile, ")\n");
+         fprintf (func_file, ")\n");
       }
 
-      fprintf (outfile, "{\n");
-      traverse_oil (outfile, root->children[block_index], types,
+      // The prologue goes to the line of the opening brace.
+      print_line (func_file, root);
+      fprintf (func_file, "{\n");
+      count_site (func_file, "entry", 0, root, 1);
+      traverse_oil (func_file, root->children[block_index], types,
             global, 1, LOCAL);
-      fprintf (outfile, "}\n");
+      fprintf (func_file, "}\n");
+
+      if (func_file != outfile) {
+         fclose (func_file);
+         string text = profile_table ("__" + func_name, func_name,
+               vector<astree*> (1, root),
+               *scanner_filename (root->filenr), root->linenr)
+               + string (func_text, func_size);
+         free (func_text);
+         fwrite (text.data(), 1, text.size(), outfile);
+         if (key != oil().fn_keys.end()) {
+            cache_store_function (key->second, text.data(),
+                  text.size());
+         }
+      }
 
       if (global->getParent() != NULL)
          global = global->getParent();
    }
 }
 
+/*
+ * Prints the table of global variables that the garbage collector
+ * scans for roots when the program is built with oc -G.  Every
+ * module registers the globals it defines.
+ */
+void print_gc_roots (FILE* outfile, SymbolTable* global,
+      const set<string>& imported) {
+   std::map<string,string>::iterator it;
+   map<string,string> mapping = global->getMapping();
+
+   fprintf (outfile, "\n#ifdef OCLIB_GC\n"
+         "static struct ocgc_root ocgc_roots[] = {\n");
+   for (it = mapping.begin(); it != mapping.end(); ++it) {
+      if (it->second.find("(") == std::string::npos
+            and imported.count (it->first) == 0) {
+         string name = convert_ident (it->first, "", GLOBAL);
+         fprintf (outfile, "%*s{&%s, sizeof %s},\n", INDENT, "",
+               name.c_str(), name.c_str());
+      }
+   }
+   fprintf (outfile, "%*s{0, 0}\n};\n", INDENT, "");
+   fprintf (outfile, "static void __attribute__ ((constructor))\n"
+         "ocgc_roots_init (void)\n{\n"
+         "%*socgc_add_roots (ocgc_roots);\n}\n#endif\n", INDENT, "");
+}
+
+/*
+ * Prints the parameter types of function, as C or as oc with the
+ * names of the parameters.
+ */
+string param_list (astree* function, const vector<string>& signature,
+      SymbolTable* types, bool as_oc) {
+   string params = "";
+   for (size_t size = 1; size < signature.size(); ++size) {
+      if (size > 1) params += ", ";
+      if (as_oc) {
+         astree* decl = function->children[2]->children[size - 1];
+         params += signature[size] + " " + *decl->children[1]->lexinfo;
+      } else {
+         params += c_type (signature[size], types);
+      }
+   }
+   if (params.empty() and not as_oc) params = "void";
+   return params;
+}
+
+/*
+ * Prints a prototype for every function defined here and for those
+ * imported from other modules, so that a function may be called
+ * before its definition or from another module.
+ */
+void print_prototypes (FILE* outfile, astree* root,
+      SymbolTable* types, SymbolTable* global) {
+   for (size_t child = 0; child < root->children.size(); ++child) {
+      astree* node = root->children[child];
+      if (not is_symbol (node, "TOK_FUNCTION")
+            and not (is_symbol (node, "TOK_PROTOTYPE")
+                     and is_imported (node))) continue;
+
+      string name = *node->children[1]->lexinfo;
+      vector<string> signature =
+            global->parseSignature (global->lookup_oil (name));
+      fprintf (outfile, "\n%s __%s (%s);",
+            c_type (signature[0], types).c_str(), name.c_str(),
+            param_list (node, signature, types, false).c_str());
+   }
+   fprintf (outfile, "\n");
+}
+
+string module_init (const string& prog_name) {
+   string name = "__ocmain_";
+   for (size_t index = 0; index < prog_name.size(); ++index) {
+      char c = prog_name[index];
+      name += isalnum ((unsigned char) c) ? c : '_';
+   }
+   return name;
+}
+
+void generate_interface (FILE* outfile, astree* root,
+      SymbolTable* types, SymbolTable* global) {
+   string guard = module_init (get_context()->prog_name);
+   fprintf (outfile, "// Interface of module %s, written by oc -c.\n"
+         "#ifndef %s_OI__\n#define %s_OI__\n",
+         get_context()->prog_name.c_str(), guard.c_str(),
+         guard.c_str());
+
+   for (size_t child = 0; child < root->children.size(); ++child) {
+      astree* node = root->children[child];
+      if (is_imported (node)) continue;
+
+      if (is_symbol (node, "TOK_STRUCT")) {
+         string name = *node->children[0]->lexinfo;
+         map<string,string> fields =
+               types->lookup_param_oil (name)->getMapping();
+         fprintf (outfile, "struct %s {", name.c_str());
+         std::map<string,string>::iterator field;
+         for (field = fields.begin(); field != fields.end(); ++field) {
+            fprintf (outfile, "\n%*s%s %s;", 3, "",
+                  field->second.c_str(), field->first.c_str());
+         }
+         fprintf (outfile, "%s}\n", fields.empty() ? "" : "\n");
+      } else if (is_symbol (node, "TOK_FUNCTION")) {
+         string name = *node->children[1]->lexinfo;
+         vector<string> signature =
+               global->parseSignature (global->lookup_oil (name));
+         fprintf (outfile, "%s %s (%s);\n", signature[0].c_str(),
+               name.c_str(),
+               param_list (node, signature, types, true).c_str());
+      } else if (is_symbol (node, "TOK_VARDECL")) {
+         // Declared only: the module defines and initializes it.
+         string name = *node->children[1]->lexinfo;
+         fprintf (outfile, "%s %s;\n",
+               global->lookup_oil (name).c_str(), name.c_str());
+      }
+   }
+   fprintf (outfile, "#endif\n");
+}
+
 void get_strcons_rec (FILE* outfile, astree* root) {
    if (root == NULL) return;
 
@@ -774,9 +1128,11 @@ void get_strcons_rec (FILE* outfile, astree* root) {
 
       if (strcmp (symbol.c_str(), "TOK_STRCON") == 0) {
          string reg_name = reg_category ("string");
-         strcon_map[constant->lexinfo->c_str()] = reg_name;
-         fprintf (outfile, "\nubyte *%s = %s;", reg_name.c_str(),
-               constant->lexinfo->c_str());
+         ++oil().nstrcons;
+         oil().strcon_map[constant->lexinfo->c_str()] = reg_name;
+         fprintf (outfile, "\n%subyte *%s = %s;",
+               get_context()->options->compile_only ? "static " : "",
+               reg_name.c_str(), constant->lexinfo->c_str());
       }
    }
 
@@ -786,6 +1142,76 @@ void get_strcons_rec (FILE* outfile, astree* root) {
    }
 }
 
+/*
+ * Collects every function beneath root.
+ */
+void find_functions (astree* root, vector<astree*>* functions) {
+   if (root == NULL) return;
+   if (strcmp ((char *)get_yytname (root->symbol),
+         "TOK_FUNCTION") == 0) {
+      functions->push_back (root);
+   }
+   for (size_t child = 0; child < root->children.size();
+         ++child) {
+      find_functions (root->children[child], functions);
+   }
+}
+
+/*
+ * Tells whether function goes before other in the oil: with a
+ * profile, the hot functions come first, the busiest first, and the
+ * cold ones last, so that the code that runs shares the fewest
+ * pages of the program.
+ */
+bool hotter (astree* function, astree* other) {
+   const function_profile* first = profile_of (function);
+   const function_profile* second = profile_of (other);
+   int first_rank = first == NULL ? 1
+                  : first->hot ? 0 : first->cold ? 2 : 1;
+   int second_rank = second == NULL ? 1
+                   : second->hot ? 0 : second->cold ? 2 : 1;
+   if (first_rank != second_rank) return first_rank < second_rank;
+   return first_rank == 0 and first->weight > second->weight;
+}
+
+/*
+ * Returns the statements of root outside of any function, which
+ * __ocmain runs.
+ */
+vector<astree*> global_statements (astree* root) {
+   vector<astree*> statements;
+   for (size_t child = 0; child < root->children.size(); ++child) {
+      astree* node = root->children[child];
+      if (is_imported (node) or is_symbol (node, "TOK_FUNCTION")
+            or is_symbol (node, "TOK_PROTOTYPE")
+            or is_symbol (node, "TOK_STRUCT")) continue;
+      statements.push_back (node);
+   }
+   return statements;
+}
+
+/*
+ * Prints the table of the counters of every function defined here
+ * and of ocmain, which the runtime writes to the profile at exit.
+ */
+void print_profile_functions (FILE* outfile, astree* root,
+      const string& ocmain) {
+   fprintf (outfile, "\nstatic struct ocprof_function "
+         "*ocprof_functions[] = {\n");
+   for (size_t child = 0; child < root->children.size(); ++child) {
+      astree* node = root->children[child];
+      if (not is_symbol (node, "TOK_FUNCTION")) continue;
+      fprintf (outfile, "%*s&ocprof__%s,\n", INDENT, "",
+            node->children[1]->lexinfo->c_str());
+   }
+   fprintf (outfile, "%*s&ocprof%s,\n%*s0\n};\n", INDENT, "",
+         ocmain.c_str(), INDENT, "");
+   fprintf (outfile, "static void __attribute__ ((constructor))\n"
+         "ocprof_functions_init (void)\n{\n"
+         "%*socprof_add_functions (ocprof_functions);\n}\n",
+         INDENT, "");
+}
+
 void generate_oil (FILE* outfile, astree* root, SymbolTable* types,
       SymbolTable* global) {
    fprintf (outfile, "#define __OCLIB_C__\n"
@@ -809,9 +1235,17 @@ void generate_oil (FILE* outfile, astree* root, SymbolTable* types,
       }
    }
 
-   // Place all string constants in a map assigned to a register
-   // counter and initialize
-   get_strcons_rec (outfile, root);
+   // String constants, numbered by prepare_oil
+   fputs (oil().strcon_decls.c_str(), outfile);
+
+   // Globals from the interfaces of other modules
+   set<string> imported;
+   for (size_t child = 0; child < root->children.size(); ++child) {
+      astree* node = root->children[child];
+      if (is_symbol (node, "TOK_VARDECL") and is_imported (node)) {
+         imported.insert (*node->children[1]->lexinfo);
+      }
+   }
 
    // Print global variable declarations, if any
    if (!global->getMapping().empty()) {
@@ -820,12 +1254,14 @@ void generate_oil (FILE* outfile, astree* root, SymbolTable* types,
 
       for (it = mapping.begin(); it != mapping.end(); ++it) {
          if (it->second.find("(") == std::string::npos) {
+            const char* storage =
+                  imported.count (it->first) > 0 ? "extern " : "";
             if (is_struct (it->second, types)) {
-               fprintf (outfile, "\nstruct %s %s;",
+               fprintf (outfile, "\n%sstruct %s %s;", storage,
                      converted_type (it->second).c_str(),
                      convert_ident (it->first, "",  GLOBAL).c_str());
             } else {
-               fprintf (outfile, "\n%s %s;",
+               fprintf (outfile, "\n%s%s %s;", storage,
                      converted_type (it->second).c_str(),
                      convert_ident (it->first, "",  GLOBAL).c_str());
             }
@@ -835,12 +1271,113 @@ void generate_oil (FILE* outfile, astree* root, SymbolTable* types,
       fprintf (outfile, "\n");
    }
 
+   print_gc_roots (outfile, global, imported);
+
+   print_prototypes (outfile, root, types, global);
+
    // Print all functions with parameters and statements, if any
-   generate_oil_func (outfile, root, types, global, 0);
+   vector<astree*> functions;
+   find_functions (root, &functions);
+   stable_sort (functions.begin(), functions.end(), hotter);
+   for (size_t index = 0; index < functions.size(); ++index) {
+      generate_oil_func (outfile, functions[index], types, global, 1);
+   }
+
+   // Print the global statements.  A module has its own function
+   // for them, which the linked program calls.
+   reset_counters();
+   const compile_options* options = get_context()->options;
+   const string& filename = get_context()->filename;
+   string ocmain = "__ocmain";
+   if (options->compile_only) {
+      ocmain = module_init (get_context()->prog_name);
+   }
+   oil().profile_table = "ocprof_sites" + ocmain;
+   oil().fn_profile = profile_of (root);
+   FILE* main_file = outfile;
+   char* main_text = NULL;
+   size_t main_size = 0;
+   if (options->instrument) {
+      main_file = open_memstream (&main_text, &main_size);
+   }
+   fprintf (main_file, "\n");
+   print_line (main_file, filename, 1);
+   fprintf (main_file, "void %s ()\n{\n", ocmain.c_str());
+   count_site (main_file, "entry", 0, filename, 1, 1);
+   traverse_ast (main_file, root, types, global, 1, GLOBAL);
+   fprintf (main_file, "}\n");
+
+   if (main_file != outfile) {
+      fclose (main_file);
+      fputs (profile_table (ocmain, ocmain, global_statements (root),
+            filename, 1).c_str(), outfile);
+      fwrite (main_text, 1, main_size, outfile);
+      free (main_text);
+      print_profile_functions (outfile, root, ocmain);
+   }
+
+}
+
+/*
+ * Reads the profile of --profile-use and finds in it each of the
+ * functions and the statements of __ocmain by their fingerprints.
+ * Those that changed since, or that it lacks, have no profile.
+ */
+void match_profile (astree* root, const vector<astree*>& functions) {
+   const string& path = get_context()->options->profile_use;
+   if (path.empty()) return;
+   if (not profile_load (path, &oil().profile)) {
+      eprintf ("%:%s: %s, compiling without a profile\n",
+            path.c_str(), strerror (errno));
+      return;
+   }
+   program_profile::iterator found;
+   for (size_t index = 0; index < functions.size(); ++index) {
+      found = oil().profile.find (tree_fingerprint (
+            vector<astree*> (1, functions[index])));
+      if (found == oil().profile.end()) continue;
+      oil().fn_profiles[functions[index]] = &found->second;
+   }
+   found = oil().profile.find (tree_fingerprint (
+         global_statements (root)));
+   if (found != oil().profile.end()) {
+      oil().fn_profiles[root] = &found->second;
+   }
+   DEBUGF ('p', "%zu of %zu functions in the profile\n",
+         oil().fn_profiles.size(), functions.size() + 1);
+}
 
-   // Print the global statements
-   fprintf (outfile, "\nvoid __ocmain ()\n{\n");
-   traverse_ast (outfile, root, types, global, 1, GLOBAL);
-   fprintf (outfile, "}\n");
+void prepare_oil (astree* root, SymbolTable* types,
+      SymbolTable* global) {
+   // Place all string constants in a map assigned to a register
+   // counter and keep their declarations for generate_oil.
+   char* decls = NULL;
+   size_t decls_size = 0;
+   FILE* decls_file = open_memstream (&decls, &decls_size);
+   get_strcons_rec (decls_file, root);
+   fclose (decls_file);
+   oil().strcon_decls.assign (decls, decls_size);
+   free (decls);
+
+   vector<astree*> functions;
+   find_functions (root, &functions);
+   match_profile (root, functions);
+   for (size_t index = 0; index < functions.size(); ++index) {
+      string key = cache_function_key (functions[index], types,
+            global, oil().strcon_map, oil().nstrcons,
+            profile_summary (profile_of (functions[index])));
+      if (key.empty()) continue;
+      string text;
+      if (cache_load_function (key, &text)) {
+         oil().fn_cached[functions[index]] = text;
+      } else {
+         oil().fn_keys[functions[index]] = key;
+      }
+   }
+   DEBUGF ('c', "%zu of %zu functions cached\n",
+         oil().fn_cached.size(), functions.size());
+}
 
+bool oil_cached (astree* function) {
+   return oil().fn_cached.count (function) > 0;
 }
@@ -11,4 +11,37 @@
 void generate_oil (FILE* outfile, astree* yyparse_astree,
       SymbolTable* global, SymbolTable* types);
 
+void prepare_oil (astree* root, SymbolTable* types,
+      SymbolTable* global);
+   //
+   // Numbers the string constants and looks up the oil of every
+   // function in the cache.  Must be called after the symbol tables
+   // are built and before typecheck_rec and generate_oil.
+   //
+
+bool is_imported (astree* node);
+   //
+   // Tells whether node was read from the interface (.oi) of another
+   // module, so that it is declared here but defined there.
+   //
+
+string module_init (const string& prog_name);
+   //
+   // Returns the name of the function that runs the statements of
+   // module prog_name when it is compiled with -c.
+   //
+
+void generate_interface (FILE* outfile, astree* root,
+      SymbolTable* types, SymbolTable* global);
+   //
+   // Writes the interface of a module: its structs, functions and
+   // globals as oc declarations, which other modules #include.
+   //
+
+bool oil_cached (astree* function);
+   //
+   // Tells whether the oil of function came from the cache, in
+   // which case it needs neither type checking nor generation.
+   //
+
 #endif /* OILPRINT_H_ */
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "context.h"
 #include "lyutils.h"
 #include "astree.h"
 
@@ -47,7 +48,7 @@
 
 %%
 
-start     : program             { yyparse_astree = $1; }
+start     : program             { get_context()->yyparse_astree = $1; }
           ;
           
 program   : program structdef   { $$ = adopt1 ($1, $2); }
@@ -173,6 +174,9 @@ vardecl   : type IDENT '=' expr ';'
                                   $3->symbol = TOK_VARDECL;
                                   $3 = adopt2 ($3, $1, $2);
                                   $$ = adopt1 ($3, $4); }
+          | type IDENT ';'      { $2->symbol = TOK_DECLID;
+                                  $3->symbol = TOK_VARDECL;
+                                  $$ = adopt2 ($3, $1, $2); }
           ;
 
 while     : TOK_WHILE '(' expr ')' statement
@@ -0,0 +1,270 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <atomic>
+#include <new>
+using namespace std;
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "auxlib.h"
+#include "phases.h"
+#include "trace.h"
+
+const char* const phase_names[NPHASES] = {
+   "cpp", "parse", "symbols", "typecheck", "oil", "dumps", "gcc",
+   "write", "link",
+};
+
+const char* const counter_names[NCOUNTERS] = {
+   "cycles", "instructions", "l1d_misses", "llc_misses",
+   "branch_misses",
+};
+
+// Type and config in perf_event_attr of each counter.
+static const struct {
+   uint32_t type;
+   uint64_t config;
+} counter_events[NCOUNTERS] = {
+   {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+   {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+   {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+         | PERF_COUNT_HW_CACHE_OP_READ << 8
+         | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+   {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+   {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static atomic<bool> use_counters (false);
+
+// Counters of one thread, opened the first time it measures a phase
+// with counters on and closed when it exits, so that the threads of
+// each request of a server open their own.
+struct thread_counters {
+   bool opened;
+   int fds[NCOUNTERS];
+   thread_counters(): opened (false) {
+      for (int counter = 0; counter < NCOUNTERS; ++counter) {
+         fds[counter] = -1;
+      }
+   }
+   ~thread_counters() {
+      for (int counter = 0; counter < NCOUNTERS; ++counter) {
+         if (fds[counter] >= 0) close (fds[counter]);
+      }
+   }
+};
+static thread_local thread_counters counters;
+
+// Calls of operator new made by each thread, for the phases.
+static thread_local long thread_allocs = 0;
+static thread_local size_t thread_alloc_bytes = 0;
+
+void* operator new (size_t size) {
+   ++thread_allocs;
+   thread_alloc_bytes += size;
+   void* block = malloc (size == 0 ? 1 : size);
+   if (block == NULL) throw bad_alloc();
+   return block;
+}
+
+void operator delete (void* block) noexcept {
+   free (block);
+}
+
+void operator delete (void* block, size_t) noexcept {
+   free (block);
+}
+
+void phase_use_counters (bool use) {
+   use_counters = use;
+}
+
+/*
+ * Opens the counters of the calling thread.  Counting starts at
+ * once and only in user mode, which an unprivileged process may
+ * usually count.
+ */
+static void open_counters (void) {
+   counters.opened = true;
+   for (int counter = 0; counter < NCOUNTERS; ++counter) {
+      struct perf_event_attr attr;
+      memset (&attr, 0, sizeof attr);
+      attr.size = sizeof attr;
+      attr.type = counter_events[counter].type;
+      attr.config = counter_events[counter].config;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                       | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      counters.fds[counter] = syscall (__NR_perf_event_open, &attr, 0,
+            -1, -1, PERF_FLAG_FD_CLOEXEC);
+      if (counters.fds[counter] < 0) {
+         DEBUGF ('m', "counter %s: %s\n", counter_names[counter],
+               strerror (errno));
+      }
+   }
+}
+
+/*
+ * Reads the counters of the calling thread into counts and returns
+ * the bits of those that could be read.  A counter that shared the
+ * hardware with others is scaled up to the time it was enabled.
+ */
+static unsigned read_counters (uint64_t* counts) {
+   if (not use_counters) return 0;
+   if (not counters.opened) open_counters();
+   unsigned counted = 0;
+   for (int counter = 0; counter < NCOUNTERS; ++counter) {
+      uint64_t value[3];      // Count, time enabled, time running
+      if (counters.fds[counter] < 0
+            or read (counters.fds[counter], value, sizeof value)
+               != sizeof value) continue;
+      counts[counter] = value[2] == 0 ? 0
+            : value[0] * ((double) value[1] / value[2]);
+      counted |= 1 << counter;
+   }
+   return counted;
+}
+
+static double seconds_between (const struct timespec& start,
+      const struct timespec& end) {
+   return (end.tv_sec - start.tv_sec)
+        + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static long peak_rss_kb (void) {
+   struct rusage usage;
+   getrusage (RUSAGE_SELF, &usage);
+   return usage.ru_maxrss;
+}
+
+void phase_start (phase_clock* clock, int phase) {
+   clock->phase = phase;
+   clock_gettime (CLOCK_MONOTONIC, &clock->wall);
+   clock_gettime (CLOCK_THREAD_CPUTIME_ID, &clock->cpu);
+   clock->rss_kb = peak_rss_kb();
+   clock->allocs = thread_allocs;
+   clock->alloc_bytes = thread_alloc_bytes;
+   clock->counted = read_counters (clock->counts);
+}
+
+void phase_stop (const phase_clock& clock, phase_times* phases) {
+   phase_times* times = &phases[clock.phase];
+   uint64_t counts[NCOUNTERS];
+   unsigned counted = clock.counted == 0 ? 0 : read_counters (counts);
+   counted &= clock.counted;
+   struct timespec wall;
+   struct timespec cpu;
+   clock_gettime (CLOCK_MONOTONIC, &wall);
+   clock_gettime (CLOCK_THREAD_CPUTIME_ID, &cpu);
+   times->wall += seconds_between (clock.wall, wall);
+   times->cpu += seconds_between (clock.cpu, cpu);
+   times->rss_kb += peak_rss_kb() - clock.rss_kb;
+   times->allocs += thread_allocs - clock.allocs;
+   times->alloc_bytes += thread_alloc_bytes - clock.alloc_bytes;
+   for (int counter = 0; counter < NCOUNTERS; ++counter) {
+      if (not (counted & 1 << counter)
+            or counts[counter] < clock.counts[counter]) continue;
+      times->counts[counter] += counts[counter] - clock.counts[counter];
+   }
+   times->counted |= counted;
+   TRACE_SPAN (TRACE_PHASES, EVENT_PHASE, clock.wall, clock.phase);
+}
+
+void phase_child (int phase, const struct timespec& started,
+      const struct rusage& usage, phase_times* phases) {
+   phase_times* times = &phases[phase];
+   struct timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+   times->wall += seconds_between (started, now);
+   times->cpu += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+               + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+   if (times->rss_kb < usage.ru_maxrss) times->rss_kb = usage.ru_maxrss;
+   times->allocs = -1;
+   TRACE_SPAN (TRACE_PHASES, EVENT_PHASE, started, phase);
+}
+
+void phase_add (phase_times* total, const phase_times& times) {
+   total->wall += times.wall;
+   total->cpu += times.cpu;
+   for (int counter = 0; counter < NCOUNTERS; ++counter) {
+      total->counts[counter] += times.counts[counter];
+   }
+   total->counted |= times.counted;
+   if (times.allocs < 0) {
+      if (total->rss_kb < times.rss_kb) total->rss_kb = times.rss_kb;
+      total->allocs = -1;
+   } else {
+      total->rss_kb += times.rss_kb;
+      total->allocs += times.allocs;
+      total->alloc_bytes += times.alloc_bytes;
+   }
+}
+
+void phase_print (FILE* out, int form, const phase_times* times,
+      const char* indent) {
+   unsigned counted = 0;
+   for (int phase = 0; phase < NPHASES; ++phase) {
+      counted |= times[phase].counted;
+   }
+   if (form == REPORT_TEXT) {
+      fprintf (out, "%s%-10s %9s %9s %9s %9s %9s", indent, "phase",
+            "wall s", "cpu s", "rss KB", "allocs", "alloc KB");
+      for (int counter = 0; counter < NCOUNTERS; ++counter) {
+         if (counted & 1 << counter) {
+            fprintf (out, " %13s", counter_names[counter]);
+         }
+      }
+      fprintf (out, "\n");
+   }
+   const char* separator = "";
+   for (int phase = 0; phase < NPHASES; ++phase) {
+      const phase_times& time = times[phase];
+      if (time.wall == 0) continue;
+      if (form == REPORT_JSON) {
+         fprintf (out, "%s%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f,"
+               " \"rss_kb\": %ld", separator, indent,
+               phase_names[phase], time.wall, time.cpu, time.rss_kb);
+         if (time.allocs >= 0) {
+            fprintf (out, ", \"allocs\": %ld, \"alloc_bytes\": %zu",
+                  time.allocs, time.alloc_bytes);
+         }
+         const char* member = ", \"counters\": {";
+         for (int counter = 0; counter < NCOUNTERS; ++counter) {
+            if (not (time.counted & 1 << counter)) continue;
+            fprintf (out, "%s\"%s\": %llu", member,
+                  counter_names[counter],
+                  (unsigned long long) time.counts[counter]);
+            member = ", ";
+         }
+         if (time.counted != 0) fprintf (out, "}");
+         fprintf (out, "}");
+         separator = ",\n";
+         continue;
+      }
+      fprintf (out, "%s%-10s %9.4f %9.4f %9ld", indent,
+            phase_names[phase], time.wall, time.cpu, time.rss_kb);
+      if (time.allocs >= 0) {
+         fprintf (out, " %9ld %9zu", time.allocs,
+               time.alloc_bytes / 1024);
+      } else {
+         fprintf (out, " %9s %9s", "-", "-");
+      }
+      for (int counter = 0; counter < NCOUNTERS; ++counter) {
+         if (not (counted & 1 << counter)) continue;
+         if (time.counted & 1 << counter) {
+            fprintf (out, " %13llu",
+                  (unsigned long long) time.counts[counter]);
+         } else {
+            fprintf (out, " %13s", "-");
+         }
+      }
+      fprintf (out, "\n");
+   }
+   if (form == REPORT_JSON and *separator != '\0') fprintf (out, "\n");
+}
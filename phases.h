@@ -0,0 +1,117 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __PHASES_H__
+#define __PHASES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+//
+// DESCRIPTION
+//    Measurements of the phases of a compilation for the -T report.
+//    A phase run by the compiler itself is timed with the wall clock
+//    and the CPU clock of its thread, together with the growth of
+//    the peak RSS of the process and the calls of operator new made
+//    by the thread meanwhile.  A phase run by a child, cpp or gcc,
+//    is timed from its start until it is reaped, and its CPU time
+//    and peak RSS come from wait4(2).  Since the peak RSS belongs to
+//    the whole process, its growth is only attributed roughly when
+//    several files are compiled at once.
+//
+//    With --counters, the phases run by the compiler also read the
+//    hardware counters of their thread with perf_event_open(2).  A
+//    counter the kernel refuses, for lack of permission or of the
+//    hardware, is left out of the report without a word.
+//
+
+// Forms of the -T and --stats reports.
+enum { REPORT_OFF, REPORT_TEXT, REPORT_JSON };
+
+enum {
+   PHASE_CPP,                 // The preprocessor, a child
+   PHASE_PARSE,               // Scanner and parser, or a .astb load
+   PHASE_SYMBOLS,             // traverse_ast
+   PHASE_TYPECHECK,           // prepare_oil and typecheck_rec
+   PHASE_OIL,                 // generate_oil, while gcc reads it
+   PHASE_DUMPS,               // Formatting the dumps into memory
+   PHASE_GCC,                 // The back end, a child
+   PHASE_WRITE,               // Waiting for the writer to finish
+   PHASE_LINK,                // gcc linking the modules of -o
+   NPHASES,
+};
+
+extern const char* const phase_names[NPHASES];
+
+enum {
+   COUNTER_CYCLES,
+   COUNTER_INSTRUCTIONS,
+   COUNTER_L1D_MISSES,        // Level 1 data cache, reads
+   COUNTER_LLC_MISSES,        // Last level cache
+   COUNTER_BRANCH_MISSES,
+   NCOUNTERS,
+};
+
+extern const char* const counter_names[NCOUNTERS];
+
+struct phase_times {
+   double wall;               // Seconds
+   double cpu;                // Seconds, user and system
+   long rss_kb;               // Growth of peak RSS, or a child's peak
+   long allocs;               // Calls of operator new, -1 for a child
+   size_t alloc_bytes;        // Bytes they asked for
+   unsigned counted;          // Bit of each counter that was read
+   uint64_t counts[NCOUNTERS];
+   phase_times(): wall (0), cpu (0), rss_kb (0), allocs (0),
+         alloc_bytes (0), counted (0), counts() {}
+};
+
+struct phase_clock {
+   int phase;
+   struct timespec wall;
+   struct timespec cpu;
+   long rss_kb;
+   long allocs;
+   size_t alloc_bytes;
+   unsigned counted;
+   uint64_t counts[NCOUNTERS];
+};
+
+void phase_use_counters (bool use);
+   //
+   // Turns the hardware counters on or off for the phases measured
+   // from now on, in every thread.
+   //
+
+void phase_start (phase_clock* clock, int phase);
+void phase_stop (const phase_clock& clock, phase_times* phases);
+   //
+   // Start measuring phase in the calling thread, and add what
+   // happened since to phases[phase].  A phase may be measured in
+   // several pieces.  Each piece is traced as a span.
+   //
+
+void phase_child (int phase, const struct timespec& started,
+      const struct rusage& usage, phase_times* phases);
+   //
+   // Adds a child started at started, on the monotonic clock, and
+   // reaped just now with usage to phases[phase].
+   //
+
+void phase_add (phase_times* total, const phase_times& times);
+   //
+   // Adds times to *total.  The peak RSS of children is the largest
+   // one.
+   //
+
+void phase_print (FILE* out, int form, const phase_times* times,
+      const char* indent);
+   //
+   // Prints a table of the phases, or in JSON an object with a member
+   // for each phase, lines starting with indent.  Phases that did
+   // not run are left out, and so are counters that were not read.
+   //
+
+#endif
@@ -0,0 +1,296 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "astio.h"
+#include "astree.h"
+#include "auxlib.h"
+#include "cache.h"
+#include "context.h"
+#include "lyutils.h"
+#include "prelude.h"
+
+// Snapshots made or loaded by this process.  Entries are never
+// removed, so a snapshot found under the lock may be read after it.
+static map<string,string> snapshots;
+static mutex snapshots_lock;
+
+/*
+ * Parses a line marker of cpp, # linenr "filename" flags.  Returns
+ * its first flag, 0 if it has none, or -1 if line is not a marker.
+ */
+static int line_marker (const string& line, string* filename) {
+   int linenr = 0;
+   int name_end = 0;
+   char name[line.size() + 1];
+   if (sscanf (line.c_str(), "# %d \"%[^\"]\"%n",
+               &linenr, name, &name_end) != 2 or name_end == 0) {
+      return -1;
+   }
+   *filename = name;
+   int flag = 0;
+   sscanf (line.c_str() + name_end, "%d", &flag);
+   return flag;
+}
+
+/*
+ * Finds the prelude in the cpp output: the first file included by
+ * the program itself, if nothing but line markers and blank lines
+ * come before it.  Sets *start to the offset of the line marker
+ * entering it and *end to that of the one returning from it.
+ */
+static bool find_prelude (compile_context* ctx, size_t* start,
+      size_t* end) {
+   const string& text = ctx->cpp_output;
+   string current;
+   int depth = 0;
+   *start = string::npos;
+   for (size_t pos = 0; pos < text.size(); ) {
+      size_t next = text.find ('\n', pos);
+      next = next == string::npos ? text.size() : next + 1;
+      if (text[pos] == '#') {
+         string filename;
+         int flag = line_marker (text.substr (pos, next - pos),
+               &filename);
+         if (*start == string::npos) {
+            if (flag < 0) return false;
+            if (flag == 1 and current == ctx->filename) {
+               *start = pos;
+               depth = 1;
+            }
+            current = filename;
+         } else if (flag == 1) {
+            ++depth;
+         } else if (flag == 2 and --depth == 0) {
+            *end = pos;
+            return true;
+         }
+      } else if (*start == string::npos
+            and text.find_first_not_of (" \t\r\n", pos) < next) {
+         return false;
+      }
+      pos = next;
+   }
+   return false;
+}
+
+/*
+ * Runs the parser on stream and adds the trees to the root made by
+ * an earlier run, if there was one.
+ */
+static int parse_stream (compile_context* ctx, FILE* stream) {
+   astree* root = ctx->yyparse_astree;
+   yyrestart (stream);
+   int parsecode = yyparse();
+   astree* stream_root = ctx->yyparse_astree;
+   if (root != NULL and stream_root != root) {
+      for (size_t child = 0; child < stream_root->children.size();
+            ++child) {
+         adopt1 (root, stream_root->children[child]);
+      }
+      stream_root->children.clear();
+      free_ast (stream_root);
+      ctx->yyparse_astree = root;
+   }
+   return parsecode;
+}
+
+/*
+ * Runs the parser on size bytes of the cpp output from start.
+ */
+static int parse_part (compile_context* ctx, size_t start,
+      size_t size) {
+   FILE* part = fmemopen ((void*) (ctx->cpp_output.data() + start),
+         size, "r");
+   if (part == NULL) {
+      syserrprintf ("fmemopen");
+      return 1;
+   }
+   int parsecode = parse_stream (ctx, part);
+   fclose (part);
+   return parsecode;
+}
+
+/*
+ * Parses the prelude and, if that went without errors, saves it as
+ * a snapshot under key.
+ */
+static int record_prelude (compile_context* ctx, size_t start,
+      size_t end, const string& key) {
+   astree* root = ctx->yyparse_astree;
+   size_t first_file = ctx->included_filenames.size();
+   size_t first_child = root->children.size();
+
+   // The .tok lines go into the snapshot even if this compilation
+   // does not write a .tok file, since later ones may.
+   FILE* tok_file = ctx->tok_file;
+   char* tok_text = NULL;
+   size_t tok_size = 0;
+   ctx->tok_file = open_memstream (&tok_text, &tok_size);
+   vector<string>* intern_log = ctx->intern_log;
+   vector<string> strings;
+   ctx->intern_log = &strings;
+   int parsecode = parse_part (ctx, start, end - start);
+   ctx->intern_log = intern_log;
+   if (intern_log != NULL) {
+      intern_log->insert (intern_log->end(), strings.begin(),
+            strings.end());
+   }
+   fclose (ctx->tok_file);
+   ctx->tok_file = tok_file;
+   if (tok_file != NULL) fwrite (tok_text, 1, tok_size, tok_file);
+
+   if (parsecode == 0 and get_exitstatus() == EXIT_SUCCESS) {
+      string snapshot;
+      astio_put_int (&snapshot,
+            ctx->included_filenames.size() - first_file);
+      for (size_t file = first_file;
+            file < ctx->included_filenames.size(); ++file) {
+         astio_put_string (&snapshot, ctx->included_filenames[file]);
+      }
+      astio_put_string (&snapshot, string (tok_text, tok_size));
+      astio_put_int (&snapshot, strings.size());
+      for (size_t index = 0; index < strings.size(); ++index) {
+         astio_put_string (&snapshot, strings[index]);
+      }
+      astio_put_int (&snapshot, root->children.size() - first_child);
+      for (size_t child = first_child; child < root->children.size();
+            ++child) {
+         astio_put_tree (&snapshot, root->children[child]);
+      }
+      cache_store_prelude (key, snapshot);
+      lock_guard<mutex> guard (snapshots_lock);
+      snapshots.insert (make_pair (key, snapshot));
+   }
+   free (tok_text);
+   return parsecode;
+}
+
+/*
+ * Tells whether every node of tree is from one of the first nfiles
+ * files of the compilation.
+ */
+static bool files_known (const astree* tree, size_t nfiles) {
+   if (tree->filenr >= nfiles) return false;
+   for (size_t child = 0; child < tree->children.size(); ++child) {
+      if (not files_known (tree->children[child], nfiles)) return false;
+   }
+   return true;
+}
+
+/*
+ * Adds a snapshot to the compilation as if the prelude had just
+ * been parsed.  The strings are interned first and in the order the
+ * scanner met them, so that the string set comes out the same.
+ * Returns false, changing nothing but the string set, if the
+ * snapshot is damaged.
+ */
+static bool load_prelude (compile_context* ctx,
+      const string& snapshot) {
+   astio_reader in (snapshot.data(), snapshot.size());
+   vector<string> filenames;
+   long nfiles = astio_get_int (&in);
+   for (long file = 0; file < nfiles and not in.failed; ++file) {
+      filenames.push_back (astio_get_string (&in));
+   }
+   string tok_text = astio_get_string (&in);
+   vector<string> strings;
+   long nstrings = astio_get_int (&in);
+   for (long index = 0; index < nstrings and not in.failed; ++index) {
+      strings.push_back (astio_get_string (&in));
+   }
+   long ntrees = astio_get_int (&in);
+   if (in.failed) return false;
+
+   for (size_t index = 0; index < strings.size(); ++index) {
+      intern_stringset (strings[index].c_str());
+   }
+   vector<astree*> trees;
+   for (long tree = 0; tree < ntrees and not in.failed; ++tree) {
+      astree* node = astio_get_tree (&in);
+      if (node != NULL) trees.push_back (node);
+   }
+   size_t nknown = ctx->included_filenames.size() + filenames.size();
+   bool known = true;
+   for (size_t tree = 0; tree < trees.size(); ++tree) {
+      known = known and files_known (trees[tree], nknown);
+   }
+   if (in.failed or in.pos != in.end or not known) {
+      for (size_t tree = 0; tree < trees.size(); ++tree) {
+         free_ast (trees[tree]);
+      }
+      return false;
+   }
+
+   for (size_t file = 0; file < filenames.size(); ++file) {
+      scanner_newfilename (filenames[file].c_str());
+   }
+   if (ctx->tok_file != NULL) {
+      fwrite (tok_text.data(), 1, tok_text.size(), ctx->tok_file);
+   }
+   for (size_t tree = 0; tree < trees.size(); ++tree) {
+      adopt1 (ctx->yyparse_astree, trees[tree]);
+   }
+   return true;
+}
+
+int parse_program (compile_context* ctx) {
+   size_t start = 0;
+   size_t end = 0;
+   // Tracing the scanner or parser needs them to run.
+   if (ctx->options->no_prelude or yy_flex_debug or yydebug
+         or not find_prelude (ctx, &start, &end)) {
+      yyrestart (ctx->cpp_pipe);
+      return yyparse();
+   }
+
+   // The line markers before the prelude go through the scanner,
+   // which makes the root of the program.
+   int parsecode = parse_part (ctx, 0, start);
+   if (ctx->yyparse_astree == NULL) return parsecode;
+
+   string key = cache_prelude_key (ctx->included_filenames.size(),
+         ctx->cpp_output.data() + start, end - start);
+   // A snapshot from the cache is only kept once it loaded, so that
+   // a damaged one is parsed again and replaced by record_prelude.
+   const string* snapshot = NULL;
+   string loaded;
+   {
+      lock_guard<mutex> guard (snapshots_lock);
+      map<string,string>::iterator found = snapshots.find (key);
+      if (found != snapshots.end()) snapshot = &found->second;
+   }
+   if (snapshot == NULL and cache_load_prelude (key, &loaded)) {
+      snapshot = &loaded;
+   }
+   if (snapshot != NULL and load_prelude (ctx, *snapshot)) {
+      DEBUGF ('c', "%s: prelude %s loaded\n", ctx->filename.c_str(),
+            key.c_str());
+      if (snapshot == &loaded) {
+         lock_guard<mutex> guard (snapshots_lock);
+         snapshots.insert (make_pair (key, loaded));
+      }
+   } else {
+      if (snapshot != NULL) {
+         DEBUGF ('c', "%s: prelude %s damaged\n",
+               ctx->filename.c_str(), key.c_str());
+      }
+      DEBUGF ('c', "%s: prelude %s parsed\n", ctx->filename.c_str(),
+            key.c_str());
+      parsecode = max (parsecode,
+            record_prelude (ctx, start, end, key));
+   }
+
+   // The rest of the program follows the prelude in the pipe.
+   fseek (ctx->cpp_pipe, end, SEEK_SET);
+   return max (parsecode, parse_stream (ctx, ctx->cpp_pipe));
+}
@@ -0,0 +1,30 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __PRELUDE_H__
+#define __PRELUDE_H__
+
+#include "context.h"
+
+//
+// DESCRIPTION
+//    Snapshots of the prelude, the header that a program includes
+//    before anything else, which is oclib.oh for nearly every
+//    program.  The first time a prelude is parsed, its trees, the
+//    lines it added to the .tok file, the file names it brought in
+//    and the strings it interned are saved as a binary snapshot,
+//    keyed on its cpp output.  Later compilations with the same
+//    prelude load the snapshot instead of scanning and parsing it,
+//    and the symbol table is then built from the loaded trees as
+//    usual.  Snapshots are kept for the life of the process, which
+//    for the compile server is all of its requests, and in the
+//    cache if it is enabled.  --no-prelude turns them off.
+//
+
+int parse_program (compile_context* ctx);
+   //
+   // Parses ctx->cpp_output, which ctx->cpp_pipe reads, and leaves
+   // the tree in ctx->yyparse_astree.  Returns the status of the
+   // parser.  The caller must hold the lock of the front end.
+   //
+
+#endif
@@ -0,0 +1,163 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "auxlib.h"
+#include "profile.h"
+
+// The hot functions are the busiest ones that together make up this
+// share of the weight of the program.
+static const double HOT_SHARE = 0.9;
+
+// A function called at least this share of all calls is frequent.
+static const double FREQUENT_SHARE = 0.1;
+
+// A jump taken at most or at least this often is expected.
+static const double UNLIKELY = 0.1;
+static const double LIKELY = 0.9;
+
+/*
+ * Marks the busiest functions of profile hot, up to HOT_SHARE of the
+ * weight of all of them, those never called cold, and those called
+ * for FREQUENT_SHARE of all calls or more frequent.
+ */
+static void mark_hot (program_profile* profile) {
+   vector<function_profile*> functions;
+   unsigned long total = 0;
+   unsigned long calls = 0;
+   program_profile::iterator function;
+   for (function = profile->begin(); function != profile->end();
+         ++function) {
+      functions.push_back (&function->second);
+      total += function->second.weight;
+      calls += function->second.entries;
+      function->second.cold = function->second.entries == 0;
+   }
+   for (size_t index = 0; index < functions.size(); ++index) {
+      functions[index]->frequent = functions[index]->entries > 0
+            and functions[index]->entries >= FREQUENT_SHARE * calls;
+   }
+   stable_sort (functions.begin(), functions.end(),
+         [] (const function_profile* left,
+             const function_profile* right) {
+            return left->weight > right->weight;
+         });
+   unsigned long sum = 0;
+   for (size_t index = 0; index < functions.size(); ++index) {
+      if (functions[index]->weight == 0
+            or sum >= HOT_SHARE * total) break;
+      functions[index]->hot = true;
+      sum += functions[index]->weight;
+   }
+}
+
+bool profile_load (const string& path, program_profile* profile) {
+   FILE* file = fopen (path.c_str(), "r");
+   if (file == NULL) return false;
+   char* buffer = NULL;
+   size_t size = 0;
+   function_profile* function = NULL;
+   while (getline (&buffer, &size, file) >= 0) {
+      istringstream line (buffer);
+      string word;
+      line >> word;
+      if (word == "function") {
+         string name;
+         string fingerprint;
+         unsigned long entries;
+         if (not (line >> name >> fingerprint >> entries)) {
+            function = NULL;
+            continue;
+         }
+         // Equal code has equal fingerprints; its counts add up.
+         function = &(*profile)[fingerprint];
+         if (function->name.empty()) function->name = name;
+         function->entries += entries;
+         function->weight += entries;
+      } else if (word == "site" and function != NULL) {
+         string kind;
+         int label;
+         unsigned long count;
+         if (not (line >> kind >> label >> count)) continue;
+         function->sites[kind + " " + to_string (label)] += count;
+         function->weight += count;
+         if (kind == "while") function->loops = true;
+      }
+   }
+   free (buffer);
+   fclose (file);
+   mark_hot (profile);
+   DEBUGF ('p', "%s: %zu functions\n", path.c_str(), profile->size());
+   return true;
+}
+
+/*
+ * Returns the count of the site kind numbered label of function.
+ */
+static unsigned long site_count (const function_profile* function,
+      const char* kind, int label) {
+   map<string,unsigned long>::const_iterator site =
+         function->sites.find (string (kind) + " "
+               + to_string (label));
+   return site == function->sites.end() ? 0 : site->second;
+}
+
+int profile_jump (const function_profile* function, const char* kind,
+      int label) {
+   if (function == NULL) return -1;
+
+   // The counters tell how often each way was gone: an if falls
+   // through to then and a while to its body, and each jumps to its
+   // label.  The jump to the fi of an if without else is what is
+   // left of the times it got there, ignoring returns from then.
+   unsigned long through = 0;
+   unsigned long taken = 0;
+   string target = kind;
+   if (target == "else") {
+      through = site_count (function, "then", label);
+      taken = site_count (function, "else", label);
+   } else if (target == "fi") {
+      through = site_count (function, "then", label);
+      unsigned long fi = site_count (function, "fi", label);
+      taken = fi > through ? fi - through : 0;
+   } else if (target == "break") {
+      taken = site_count (function, "break", label);
+      unsigned long tests = site_count (function, "while", label);
+      through = tests > taken ? tests - taken : 0;
+   }
+   if (through + taken == 0) return -1;
+   double share = (double) taken / (through + taken);
+   if (share <= UNLIKELY) return 0;
+   if (share >= LIKELY) return 1;
+   return -1;
+}
+
+string profile_summary (const function_profile* function) {
+   // The decisions, not the counts, so that a new profile of the same
+   // behavior leaves the cached oil alone.
+   if (function == NULL) return "";
+   string summary = function->hot ? "hot" : function->cold ? "cold"
+                  : "warm";
+   if (function->frequent) summary += " frequent";
+   if (function->loops) summary += " loops";
+   map<string,unsigned long>::const_iterator site;
+   for (site = function->sites.begin(); site != function->sites.end();
+         ++site) {
+      string kind = site->first.substr (0, site->first.find (' '));
+      int label = atoi (site->first.c_str() + kind.size());
+      if (kind == "fi" or kind == "else" or kind == "break") {
+         summary += " " + site->first + "="
+               + to_string (profile_jump (function, kind.c_str(),
+                                          label));
+      }
+   }
+   return summary;
+}
@@ -0,0 +1,58 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <map>
+#include <string>
+using namespace std;
+
+//
+// DESCRIPTION
+//    Profiles written by programs built with oc --instrument, read
+//    back by oc --profile-use to guide the oil.  The functions of a
+//    profile are known by the fingerprints of their trees, so that
+//    a function is still recognized after it moved or another one
+//    changed.  A function that changed itself no longer matches and
+//    is compiled as if there were no profile.
+//
+
+struct function_profile {
+   string name;               // As it was called when profiled
+   unsigned long entries;     // Calls, or runs of __ocmain
+   unsigned long weight;      // Entries and every site counted
+   map<string,unsigned long> sites;    // "kind label" to its count
+   bool hot;                  // Among those doing most of the work
+   bool cold;                 // Never called
+   bool frequent;             // Among the calls made most often
+   bool loops;                // Has a while loop
+   function_profile(): entries (0), weight (0), hot (false),
+         cold (false), frequent (false), loops (false) {}
+};
+
+// Functions of a profile by fingerprint.
+typedef map<string,function_profile> program_profile;
+
+bool profile_load (const string& path, program_profile* profile);
+   //
+   // Reads the profile at path into *profile and marks its hot,
+   // cold and frequent functions.  Lines it does not understand are
+   // skipped.  Returns false if the file could not be read.
+   //
+
+int profile_jump (const function_profile* function, const char* kind,
+      int label);
+   //
+   // Tells how the conditional jump to label kind_label, one of
+   // fi, else and break, went when profiled: 1 if it was almost
+   // always taken, 0 if almost never, and -1 if neither or if it
+   // was never reached.  function may be NULL.
+   //
+
+string profile_summary (const function_profile* function);
+   //
+   // Returns all that the oil of function depends on in its profile,
+   // for the key of its cached oil.  Returns "" if function is NULL.
+   //
+
+#endif
@@ -0,0 +1,319 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "auxlib.h"
+#include "backend.h"
+#include "compile.h"
+#include "context.h"
+#include "server.h"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void stop_handler (int) {
+   stop_requested = 1;
+}
+
+/*
+ * Makes dir with no access for anyone else, unless it exists, and
+ * checks that it is a directory of this user that no one else can
+ * enter, so that no one else can put a socket there.
+ */
+static bool private_directory (const string& dir) {
+   if (mkdir (dir.c_str(), 0700) < 0 and errno != EEXIST) {
+      syserrprintf (dir.c_str());
+      return false;
+   }
+   struct stat info;
+   if (lstat (dir.c_str(), &info) < 0) {
+      syserrprintf (dir.c_str());
+      return false;
+   }
+   if (not S_ISDIR (info.st_mode) or info.st_uid != getuid()
+         or (info.st_mode & 077) != 0) {
+      errprintf ("%:%s: not a private directory\n", dir.c_str());
+      return false;
+   }
+   return true;
+}
+
+string server_socket_path (void) {
+   const char* path = getenv ("OC_SOCKET");
+   if (path != NULL and *path != '\0') return path;
+   const char* runtime_dir = getenv ("XDG_RUNTIME_DIR");
+   if (runtime_dir != NULL and *runtime_dir != '\0') {
+      return string (runtime_dir) + "/oc.sock";
+   }
+   string dir = "/tmp/oc-" + to_string (getuid());
+   if (not private_directory (dir)) return "";
+   return dir + "/server.sock";
+}
+
+/*
+ * Tells whether the client runs as the same user as the server.
+ * Anyone who can reach the socket can connect, and the server
+ * compiles with the rights of its user.
+ */
+static bool same_user (int client) {
+   struct ucred peer;
+   socklen_t size = sizeof peer;
+   if (getsockopt (client, SOL_SOCKET, SO_PEERCRED, &peer, &size)
+         < 0) {
+      syserrprintf ("SO_PEERCRED");
+      return false;
+   }
+   return peer.uid == getuid();
+}
+
+/*
+ * Fills in the address of the socket.  Returns false if the path
+ * does not fit.
+ */
+static bool socket_address (const string& path, sockaddr_un* addr) {
+   memset (addr, 0, sizeof *addr);
+   addr->sun_family = AF_UNIX;
+   if (path.size() >= sizeof addr->sun_path) {
+      errprintf ("%:%s: socket path too long\n", path.c_str());
+      return false;
+   }
+   strcpy (addr->sun_path, path.c_str());
+   return true;
+}
+
+static bool write_all (int fd, const char* buf, size_t size) {
+   while (size > 0) {
+      ssize_t written = write (fd, buf, size);
+      if (written < 0) {
+         if (errno == EINTR) continue;
+         return false;
+      }
+      buf += written;
+      size -= written;
+   }
+   return true;
+}
+
+static bool read_all (int fd, string* data) {
+   char buf[4096];
+   for (;;) {
+      ssize_t got = read (fd, buf, sizeof buf);
+      if (got == 0) return true;
+      if (got < 0) {
+         if (errno == EINTR) continue;
+         return false;
+      }
+      data->append (buf, got);
+   }
+}
+
+/*
+ * Compiles one request.  While it runs, the client's socket is the
+ * server's stderr, so every diagnostic, including those of cpp and
+ * gcc, goes back to the client.
+ */
+static void serve_request (int client) {
+   string request;
+   if (not read_all (client, &request)) {
+      syserrprintf ("read");
+      return;
+   }
+   vector<string> fields;
+   size_t start = 0;
+   for (;;) {
+      size_t end = request.find ('\0', start);
+      if (end == string::npos) break;
+      fields.push_back (request.substr (start, end - start));
+      start = end + 1;
+   }
+   if (fields.empty()) return;
+
+   int saved_stderr = dup (STDERR_FILENO);
+   dup2 (client, STDERR_FILENO);
+   reset_exitstatus();
+
+   const string& cwd = fields[0];
+   int status = EXIT_FAILURE;
+   vector<string> artifacts;
+   if (chdir (cwd.c_str()) != 0) {
+      syserrprintf (cwd.c_str());
+   } else {
+      vector<char*> argv;
+      argv.push_back ((char*) get_execname());
+      for (size_t field = 1; field < fields.size(); ++field) {
+         argv.push_back (&fields[field][0]);
+      }
+      argv.push_back (NULL);
+
+      compile_options options;
+      vector<string> filenames;
+      if (scan_opts (argv.size() - 1, argv.data(), &options,
+                  &filenames)) {
+         options.cache_runtime = true;
+         int optstatus = get_exitstatus();
+         status = compile_files (&options, filenames, &artifacts);
+         if (optstatus > status) status = optstatus;
+      }
+      // The flags point into this request.
+      set_debugflags ("");
+   }
+
+   fflush (stderr);
+   dup2 (saved_stderr, STDERR_FILENO);
+   close (saved_stderr);
+
+   string reply (1, '\0');
+   reply += to_string (status) + "\n";
+   for (size_t index = 0; index < artifacts.size(); ++index) {
+      reply += cwd + "/" + artifacts[index] + "\n";
+   }
+   if (not write_all (client, reply.data(), reply.size())) {
+      DEBUGF ('s', "client went away: %s\n", strerror (errno));
+   }
+}
+
+int run_server (const string& socket_path) {
+   sockaddr_un addr;
+   if (not socket_address (socket_path, &addr)) return EXIT_FAILURE;
+
+   int listener = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if (listener < 0) {
+      syserrprintf ("socket");
+      return EXIT_FAILURE;
+   }
+
+   // Refuse to take the socket away from a server that still runs.
+   if (connect (listener, (sockaddr*) &addr, sizeof addr) == 0) {
+      errprintf ("%:%s: server already running\n",
+            socket_path.c_str());
+      close (listener);
+      return EXIT_FAILURE;
+   }
+   close (listener);
+   listener = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   unlink (socket_path.c_str());
+   if (listener < 0
+         or bind (listener, (sockaddr*) &addr, sizeof addr) < 0
+         or listen (listener, SOMAXCONN) < 0) {
+      syserrprintf (socket_path.c_str());
+      if (listener >= 0) close (listener);
+      return EXIT_FAILURE;
+   }
+
+   // No SA_RESTART, so that a signal interrupts accept.  A client
+   // that hangs up must not kill the server.
+   struct sigaction action;
+   memset (&action, 0, sizeof action);
+   action.sa_handler = stop_handler;
+   sigaction (SIGINT, &action, NULL);
+   sigaction (SIGTERM, &action, NULL);
+   signal (SIGPIPE, SIG_IGN);
+
+   DEBUGF ('s', "listening on %s\n", socket_path.c_str());
+   int status = EXIT_SUCCESS;
+   while (not stop_requested) {
+      int client = accept4 (listener, NULL, NULL, SOCK_CLOEXEC);
+      if (client < 0) {
+         if (errno == EINTR) continue;
+         syserrprintf ("accept");
+         status = EXIT_FAILURE;
+         break;
+      }
+      if (same_user (client)) {
+         serve_request (client);
+      } else {
+         eprintf ("%:refused a client of another user\n");
+      }
+      close (client);
+   }
+
+   DEBUGF ('s', "shutting down\n");
+   close (listener);
+   unlink (socket_path.c_str());
+   backend_cleanup();
+   return status;
+}
+
+/*
+ * Tells whether arg is --connect or an abbreviation of it, which
+ * the client must not forward to the server.
+ */
+static bool is_connect_option (const char* arg) {
+   string name (arg, strcspn (arg, "="));
+   return name.size() > 3 and string ("--connect").find (name) == 0;
+}
+
+int run_client (const string& socket_path, int argc, char** argv) {
+   sockaddr_un addr;
+   if (not socket_address (socket_path, &addr)) return EXIT_FAILURE;
+   int server = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if (server < 0
+         or connect (server, (sockaddr*) &addr, sizeof addr) < 0) {
+      syserrprintf (socket_path.c_str());
+      return EXIT_FAILURE;
+   }
+
+   char cwd[PATH_MAX];
+   if (getcwd (cwd, sizeof cwd) == NULL) {
+      syserrprintf ("getcwd");
+      return EXIT_FAILURE;
+   }
+   string request (cwd, strlen (cwd) + 1);
+   for (int argi = 1; argi < argc; ++argi) {
+      if (is_connect_option (argv[argi])) continue;
+      request.append (argv[argi], strlen (argv[argi]) + 1);
+   }
+   signal (SIGPIPE, SIG_IGN);
+   if (not write_all (server, request.data(), request.size())
+         or shutdown (server, SHUT_WR) < 0) {
+      syserrprintf (socket_path.c_str());
+      return EXIT_FAILURE;
+   }
+
+   // Diagnostics are passed on as they arrive; the rest of the
+   // reply is collected.
+   string reply;
+   bool in_diagnostics = true;
+   char buf[4096];
+   for (;;) {
+      ssize_t got = read (server, buf, sizeof buf);
+      if (got < 0 and errno == EINTR) continue;
+      if (got <= 0) break;
+      if (not in_diagnostics) {
+         reply.append (buf, got);
+         continue;
+      }
+      char* nul = (char*) memchr (buf, '\0', got);
+      size_t shown = nul == NULL ? got : nul - buf;
+      fwrite (buf, 1, shown, stderr);
+      if (nul != NULL) {
+         in_diagnostics = false;
+         reply.append (nul + 1, got - shown - 1);
+      }
+   }
+   close (server);
+
+   if (in_diagnostics) {
+      errprintf ("%:%s: server closed the connection\n",
+            socket_path.c_str());
+      return EXIT_FAILURE;
+   }
+   size_t newline = reply.find ('\n');
+   int status = atoi (reply.substr (0, newline).c_str());
+   if (newline != string::npos) {
+      fputs (reply.c_str() + newline + 1, stdout);
+   }
+   return status;
+}
@@ -0,0 +1,47 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <string>
+using namespace std;
+
+//
+// DESCRIPTION
+//    Persistent compile server.  "oc --server" listens on a Unix
+//    domain socket and compiles one request after another in the
+//    same process, so the runtime objects built for the back end
+//    are reused instead of compiling oclib.c for every program.
+//    "oc --connect file.oc" is a thin client that sends its working
+//    directory and arguments to the server, copies the diagnostics
+//    it gets back to stderr, prints the paths of the files written
+//    to stdout and exits with the status of the compilation.
+//
+//    A request is the working directory followed by the arguments,
+//    each terminated by a NUL byte.  The reply is the diagnostics,
+//    a NUL byte, the exit status on a line of its own, and then one
+//    line per artifact.
+//
+
+string server_socket_path (void);
+   //
+   // Returns the default socket: $OC_SOCKET if set, otherwise
+   // oc.sock in $XDG_RUNTIME_DIR if that is set, otherwise
+   // server.sock in /tmp/oc-<uid>, which is made if needed and must
+   // be a directory of this user that no one else can enter.
+   // Returns "" if it is not.
+   //
+
+int run_server (const string& socket_path);
+   //
+   // Serves requests until SIGINT or SIGTERM and returns the exit
+   // status for the server process.  Clients of other users are
+   // refused.
+   //
+
+int run_client (const string& socket_path, int argc, char** argv);
+   //
+   // Sends argv to the server and returns the status it reports.
+   //
+
+#endif
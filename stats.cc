@@ -0,0 +1,141 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <map>
+#include <vector>
+using namespace std;
+
+#include <stdio.h>
+
+#include "lyutils.h"
+#include "phases.h"
+#include "stats.h"
+
+static const char* const lookup_names[NLOOKUPS] = {
+   "lookup", "lookup_oil", "is_local", "is_global",
+};
+
+static const char* const register_names[NREGISTERS] = {
+   "i", "b", "p", "s",
+};
+
+void stats_count_nodes (compile_stats* stats, astree* root) {
+   // Iterative, as a long chain of statements makes a deep tree.
+   vector<astree*> pending (1, root);
+   while (not pending.empty()) {
+      astree* tree = pending.back();
+      pending.pop_back();
+      ++stats->node_kinds[tree->symbol];
+      ++stats->nodes;
+      pending.insert (pending.end(), tree->children.begin(),
+            tree->children.end());
+   }
+}
+
+void stats_count_strings (compile_stats* stats, const stringset& set) {
+   stats->strings = set.size();
+   stats->buckets = set.bucket_count();
+   for (size_t bucket = 0; bucket < set.bucket_count(); ++bucket) {
+      if (stats->max_bucket < set.bucket_size (bucket)) {
+         stats->max_bucket = set.bucket_size (bucket);
+      }
+   }
+}
+
+void stats_add (compile_stats* total, const compile_stats& stats) {
+   for (map<int,long>::const_iterator kind = stats.node_kinds.begin();
+         kind != stats.node_kinds.end(); ++kind) {
+      total->node_kinds[kind->first] += kind->second;
+   }
+   total->nodes += stats.nodes;
+   total->scopes += stats.scopes;
+   if (total->max_scope_depth < stats.max_scope_depth) {
+      total->max_scope_depth = stats.max_scope_depth;
+   }
+   for (int kind = 0; kind < NLOOKUPS; ++kind) {
+      total->lookup_tables[kind] += stats.lookup_tables[kind];
+      total->lookup_hops[kind] += stats.lookup_hops[kind];
+   }
+   total->strings += stats.strings;
+   total->buckets += stats.buckets;
+   if (total->max_bucket < stats.max_bucket) {
+      total->max_bucket = stats.max_bucket;
+   }
+   for (int reg = 0; reg < NREGISTERS; ++reg) {
+      total->temporaries[reg] += stats.temporaries[reg];
+   }
+}
+
+static double load_factor (const compile_stats& stats) {
+   return stats.buckets == 0 ? 0
+        : (double) stats.strings / stats.buckets;
+}
+
+static void print_json (FILE* out, const compile_stats& stats,
+      const char* indent) {
+   fprintf (out, "%s\"nodes\": %ld,\n%s\"node_kinds\": {", indent,
+         stats.nodes, indent);
+   const char* separator = "";
+   for (map<int,long>::const_iterator kind = stats.node_kinds.begin();
+         kind != stats.node_kinds.end(); ++kind) {
+      fprintf (out, "%s\"", separator);
+      for (const char* ch = get_yytname (kind->first); *ch != '\0';
+            ++ch) {
+         if (*ch == '"' or *ch == '\\') fputc ('\\', out);
+         fputc (*ch, out);
+      }
+      fprintf (out, "\": %ld", kind->second);
+      separator = ", ";
+   }
+   fprintf (out, "},\n%s\"scopes\": %d, \"max_scope_depth\": %d,\n",
+         indent, stats.scopes, stats.max_scope_depth);
+   fprintf (out, "%s\"lookups\": {", indent);
+   for (int kind = 0; kind < NLOOKUPS; ++kind) {
+      fprintf (out, "%s\"%s\": {\"calls\": %ld, \"hops\": %ld}",
+            kind == 0 ? "" : ", ", lookup_names[kind],
+            stats.lookup_tables[kind] - stats.lookup_hops[kind],
+            stats.lookup_hops[kind]);
+   }
+   fprintf (out, "},\n%s\"strings\": %zu, \"buckets\": %zu,"
+         " \"load_factor\": %.3f, \"max_bucket\": %zu,\n", indent,
+         stats.strings, stats.buckets, load_factor (stats),
+         stats.max_bucket);
+   fprintf (out, "%s\"temporaries\": {", indent);
+   for (int reg = 0; reg < NREGISTERS; ++reg) {
+      fprintf (out, "%s\"%s\": %ld", reg == 0 ? "" : ", ",
+            register_names[reg], stats.temporaries[reg]);
+   }
+   fprintf (out, "}\n");
+}
+
+void stats_print (FILE* out, int form, const compile_stats& stats,
+      const char* indent) {
+   if (form == REPORT_JSON) {
+      print_json (out, stats, indent);
+      return;
+   }
+   fprintf (out, "%snodes %ld, by kind:\n", indent, stats.nodes);
+   for (map<int,long>::const_iterator kind = stats.node_kinds.begin();
+         kind != stats.node_kinds.end(); ++kind) {
+      fprintf (out, "%s   %-16s %8ld\n", indent,
+            get_yytname (kind->first), kind->second);
+   }
+   fprintf (out, "%sscopes %d, deepest %d\n", indent, stats.scopes,
+         stats.max_scope_depth);
+   fprintf (out, "%s%-19s %8s %8s\n", indent, "lookups", "calls",
+         "hops");
+   for (int kind = 0; kind < NLOOKUPS; ++kind) {
+      fprintf (out, "%s   %-16s %8ld %8ld\n", indent,
+            lookup_names[kind],
+            stats.lookup_tables[kind] - stats.lookup_hops[kind],
+            stats.lookup_hops[kind]);
+   }
+   fprintf (out, "%sstrings %zu in %zu buckets, load factor %.3f,"
+         " fullest bucket %zu\n", indent, stats.strings, stats.buckets,
+         load_factor (stats), stats.max_bucket);
+   fprintf (out, "%stemporaries", indent);
+   for (int reg = 0; reg < NREGISTERS; ++reg) {
+      fprintf (out, "%s %s %ld", reg == 0 ? "" : ",",
+            register_names[reg], stats.temporaries[reg]);
+   }
+   fprintf (out, "\n");
+}
@@ -0,0 +1,81 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <map>
+using namespace std;
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "stringset.h"
+#include "symtable.h"
+
+//
+// DESCRIPTION
+//    Statistics of the work a program makes for the compiler, for the
+//    --stats report: the kinds of nodes in its tree, the scopes made
+//    and how deep they nest, how far the symbol table lookups climb
+//    through the enclosing scopes, how full the string set is and
+//    the temporaries of each register class in the oil.  The
+//    counters are cheap enough to be kept by every compilation.
+//
+
+// Symbol table lookups that are counted.
+enum {
+   LOOKUP,                    // SymbolTable::lookup
+   LOOKUP_OIL,                // SymbolTable::lookup_oil
+   LOOKUP_LOCAL,              // SymbolTable::is_local
+   LOOKUP_GLOBAL,             // SymbolTable::is_global
+   NLOOKUPS,
+};
+
+// Register classes of the temporaries in the oil.
+enum {
+   REGISTER_INT,              // i
+   REGISTER_UBYTE,            // b
+   REGISTER_POINTER,          // p
+   REGISTER_STRING,           // s
+   NREGISTERS,
+};
+
+struct compile_stats {
+   map<int,long> node_kinds;  // Nodes of the tree by token code
+   long nodes;
+   int scopes;                // Symbol tables made
+   int max_scope_depth;       // The global tables are at 0
+   long lookup_tables[NLOOKUPS];    // Tables visited
+   long lookup_hops[NLOOKUPS];      // Steps to an enclosing table
+   size_t strings;            // In the string set
+   size_t buckets;
+   size_t max_bucket;         // Strings in the fullest bucket
+   long temporaries[NREGISTERS];
+   compile_stats(): nodes (0), scopes (0), max_scope_depth (0),
+         lookup_tables(), lookup_hops(), strings (0), buckets (0),
+         max_bucket (0), temporaries() {}
+};
+
+void stats_count_nodes (compile_stats* stats, astree* root);
+   //
+   // Adds the nodes of the tree root to the histogram.
+   //
+
+void stats_count_strings (compile_stats* stats, const stringset& set);
+   //
+   // Stores the size and the fill of the string set.
+   //
+
+void stats_add (compile_stats* total, const compile_stats& stats);
+   //
+   // Adds the statistics of one compilation to *total.
+   //
+
+void stats_print (FILE* out, int form, const compile_stats& stats,
+      const char* indent);
+   //
+   // Prints the statistics as text, or as the members of a JSON
+   // object, lines starting with indent.
+   //
+
+#endif
@@ -4,20 +4,23 @@
 #include <unordered_set>
 using namespace std;
 
+#include "context.h"
 #include "stringset.h"
 
-typedef unordered_set<string> stringset;
 typedef stringset::const_iterator stringset_citor;
 typedef stringset::const_local_iterator stringset_bucket_citor;
 
-stringset set;
-
 const string* intern_stringset (const char* string) {
-   pair<stringset_citor,bool> handle = set.insert (string);
+   compile_context* ctx = get_context();
+   pair<stringset_citor,bool> handle = ctx->strings.insert (string);
+   if (handle.second and ctx->intern_log != NULL) {
+      ctx->intern_log->push_back (string);
+   }
    return &*handle.first;
 }
 
 void dump_stringset (FILE* out) {
+   stringset& set = get_context()->strings;
    size_t max_bucket_size = 0;
    for (size_t bucket = 0; bucket < set.bucket_count(); ++bucket) {
       bool need_index = true;
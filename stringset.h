@@ -9,6 +9,8 @@ using namespace std;
 
 #include <stdio.h>
 
+typedef unordered_set<string> stringset;
+
 const string* intern_stringset (const char*);
 
 void dump_stringset (FILE*);
@@ -1,6 +1,7 @@
 #include <string.h>
 
 #include "auxlib.h"
+#include "context.h"
 #include "lyutils.h"
 #include "symtable.h"
 
@@ -10,14 +11,38 @@
 SymbolTable::SymbolTable(SymbolTable* parent) {
    // Set the parent (this might be NULL)
    this->parent = parent;
-   // Assign a unique number and increment the global N
-   this->number = SymbolTable::N++;
+   // Assign a unique number and increment the running id number
+   // of the current compilation
+   compile_context* ctx = get_context();
+   this->number = ctx->symtable_n++;
+
+   int depth = 0;
+   for (SymbolTable* table = parent; table != NULL;
+         table = table->parent) {
+      ++depth;
+   }
+   ++ctx->stats.scopes;
+   if (ctx->stats.max_scope_depth < depth) {
+      ctx->stats.max_scope_depth = depth;
+   }
+}
+
+SymbolTable::~SymbolTable() {
+   std::map<string,SymbolTable*>::iterator it;
+   for (it = this->subscopes.begin(); it != this->subscopes.end();
+         ++it) {
+      delete it->second;
+   }
 }
 
 SymbolTable* SymbolTable::getParent() {
    return this->parent;
 }
 
+int SymbolTable::getNumber() {
+   return this->number;
+}
+
 map<string,string> SymbolTable::getMapping() {
    return this->mapping;
 }
@@ -123,6 +148,8 @@ void SymbolTable::dump(FILE* symfile, int depth) {
 //
 // Returns the empty string "" if variable was not found
 string SymbolTable::lookup(string name, size_t linenr) {
+   compile_stats& stats = get_context()->stats;
+   ++stats.lookup_tables[LOOKUP];
    // Look up "name" in the identifier mapping of the current block
    if (this->mapping.count(name) > 0) {
       // If we found an entry, just return its type
@@ -132,6 +159,7 @@ string SymbolTable::lookup(string name, size_t linenr) {
    if (this->parent != NULL) {
       // look up the symbol in the surrounding scope
       // and return its reported type
+      ++stats.lookup_hops[LOOKUP];
       return this->parent->lookup(name, linenr);
    } else {
       // Return "" if the global symbol table has no entry
@@ -162,6 +190,8 @@ SymbolTable* SymbolTable::lookup_param(string type, size_t linenr) {
 //
 // Returns the empty string "" if variable was not found
 string SymbolTable::lookup_oil(string name) {
+   compile_stats& stats = get_context()->stats;
+   ++stats.lookup_tables[LOOKUP_OIL];
    // Look up "name" in the identifier mapping of the current block
    if (this->mapping.count(name) > 0) {
       // If we found an entry, just return its type
@@ -171,6 +201,7 @@ string SymbolTable::lookup_oil(string name) {
    if (this->parent != NULL) {
       // look up the symbol in the surrounding scope
       // and return its reported type
+      ++stats.lookup_hops[LOOKUP_OIL];
       return this->parent->lookup_oil (name);
    } else {
       // Return "" if the global symbol table has no entry
@@ -198,9 +229,12 @@ SymbolTable* SymbolTable::lookup_param_oil(string type) {
 // Look up name in the global block and if found, return true.
 // Otherwise, return false
 bool SymbolTable::is_global (string name) {
+   compile_stats& stats = get_context()->stats;
+   ++stats.lookup_tables[LOOKUP_GLOBAL];
    if (this->parent != NULL) {
       // look up the symbol in the surrounding scope
       // and return its reported type
+      ++stats.lookup_hops[LOOKUP_GLOBAL];
       return this->parent->is_global(name);
    }
 
@@ -217,6 +251,8 @@ bool SymbolTable::is_global (string name) {
 // Look up name in the local block and if found, return true.
 // Otherwise, return false
 bool SymbolTable::is_local (string name) {
+   compile_stats& stats = get_context()->stats;
+   ++stats.lookup_tables[LOOKUP_LOCAL];
    // Look up "name" in the identifier mapping of the current block
    if (this->mapping.count(name) > 0 && this->getParent() != NULL) {
       // If we found an entry, just return its type
@@ -227,6 +263,7 @@ bool SymbolTable::is_local (string name) {
    if (this->parent != NULL) {
       // look up the symbol in the surrounding scope
       // and return its reported type
+      ++stats.lookup_hops[LOOKUP_LOCAL];
       return this->parent->is_local (name);
    }
 
@@ -277,9 +314,6 @@ string SymbolTable::parentFunction(SymbolTable* innerScope) {
    return "";
 }
 
-// initialize running block ID to 0
-int SymbolTable::N(0);
-
 // Parses a function signature and returns all types as vector.
 // The first element of the vector is always the return type.
 //
@@ -49,8 +49,14 @@ public:
    // Use "new SymbolTable(NULL)" to create the global table
    SymbolTable(SymbolTable* parent);
 
+   // Deletes the table along with all of its inner scopes.
+   ~SymbolTable();
+
    SymbolTable *getParent();
 
+   // Returns the unique number of this block.
+   int getNumber();
+
    map<string,string> getMapping();
 
    // Creates a new empty table beneath the current table and returns
@@ -109,9 +115,6 @@ public:
    // block.
    string parentFunction(SymbolTable* innerScope);
 
-   // Running id number for symbol tables
-   static int N;
-
    // Parses a function signature and returns all types as vector.
    // The first element of the vector is always the return type.
    //
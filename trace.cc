@@ -0,0 +1,211 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "auxlib.h"
+#include "lyutils.h"
+#include "phases.h"
+#include "trace.h"
+
+// Events kept per thread, about 6 MB.
+static const size_t TRACE_RING_SIZE = 1 << 17;
+
+struct trace_event {
+   uint64_t time;             // Nanoseconds on the monotonic clock
+   uint64_t duration;         // Of a span, 0 for an instant
+   uintptr_t args[3];
+   int event;
+};
+
+struct trace_ring {
+   int thread;                // Number shown as tid
+   size_t recorded;           // Events ever, the last at recorded - 1
+   vector<trace_event> events;
+   trace_ring (int thread): thread (thread), recorded (0),
+         events (TRACE_RING_SIZE) {}
+};
+
+unsigned trace_categories = 0;
+
+// Every ring of the current trace.  Rings outlive their threads, so
+// that those of the workers are still there for trace_write.  A
+// thread holding a ring of an older trace gets a new one.
+static mutex rings_lock;
+static vector<trace_ring*> rings;
+static long generation = 0;
+static uint64_t trace_origin = 0;
+
+static thread_local trace_ring* ring = NULL;
+static thread_local long ring_generation = -1;
+
+static uint64_t nanoseconds (const struct timespec& time) {
+   return time.tv_sec * UINT64_C(1000000000) + time.tv_nsec;
+}
+
+static uint64_t now (void) {
+   struct timespec time;
+   clock_gettime (CLOCK_MONOTONIC, &time);
+   return nanoseconds (time);
+}
+
+static trace_event* next_event (void) {
+   if (ring == NULL or ring_generation != generation) {
+      lock_guard<mutex> guard (rings_lock);
+      ring = new trace_ring (rings.size() + 1);
+      rings.push_back (ring);
+      ring_generation = generation;
+   }
+   return &ring->events[ring->recorded++ % TRACE_RING_SIZE];
+}
+
+void trace_record (int event, uintptr_t a, uintptr_t b, uintptr_t c) {
+   trace_event* record = next_event();
+   record->time = now();
+   record->duration = 0;
+   record->args[0] = a;
+   record->args[1] = b;
+   record->args[2] = c;
+   record->event = event;
+}
+
+void trace_span (int event, const struct timespec& start,
+      uintptr_t a) {
+   trace_event* record = next_event();
+   record->time = nanoseconds (start);
+   record->duration = now() - record->time;
+   record->args[0] = a;
+   record->args[1] = 0;
+   record->args[2] = 0;
+   record->event = event;
+}
+
+bool trace_scan (const string& spec, string* path,
+      unsigned* categories) {
+   size_t comma = spec.find (',');
+   *path = spec.substr (0, comma);
+   *categories = comma == string::npos ? TRACE_ALL : 0;
+   while (comma != string::npos) {
+      size_t start = comma + 1;
+      comma = spec.find (',', start);
+      string name = spec.substr (start, comma - start);
+      if (name == "ast") *categories |= TRACE_AST;
+      else if (name == "phases") *categories |= TRACE_PHASES;
+      else return false;
+   }
+   return true;
+}
+
+static void clear_rings (void) {
+   lock_guard<mutex> guard (rings_lock);
+   for (size_t index = 0; index < rings.size(); ++index) {
+      delete rings[index];
+   }
+   rings.clear();
+   ++generation;
+}
+
+void trace_start (unsigned categories) {
+   clear_rings();
+   trace_origin = now();
+   trace_categories = categories;
+}
+
+/*
+ * Writes the JSON of one event, without a separator.
+ */
+static void write_event (FILE* out, int pid, int thread,
+      const trace_event& record) {
+   const uintptr_t* args = record.args;
+   const char* name = NULL;
+   const char* category = "ast";
+   switch (record.event) {
+   case EVENT_NEW_ASTREE: name = "new_astree";             break;
+   case EVENT_ADOPT:      name = "adopt1";                 break;
+   case EVENT_FREE_AST:   name = "free_ast";               break;
+   case EVENT_PHASE:      name = phase_names[args[0]];
+                          category = "phases";             break;
+   case EVENT_COMPILE:    name = "compile";
+                          category = "phases";             break;
+   }
+   double time = (int64_t) (record.time - trace_origin) / 1e3;
+   fprintf (out, "{\"name\": \"%s\", \"cat\": \"%s\", \"pid\": %d,"
+         " \"tid\": %d, \"ts\": %.3f", name, category, pid, thread,
+         time);
+   if (record.event == EVENT_PHASE or record.event == EVENT_COMPILE) {
+      fprintf (out, ", \"ph\": \"X\", \"dur\": %.3f",
+            record.duration / 1e3);
+   } else {
+      fprintf (out, ", \"ph\": \"i\", \"s\": \"t\"");
+   }
+   switch (record.event) {
+   case EVENT_NEW_ASTREE:
+      fprintf (out, ", \"args\": {\"node\": \"%#" PRIxPTR "\","
+            " \"symbol\": \"%s\", \"line\": %d}", args[0],
+            get_yytname (args[1]), (int) args[2]);
+      break;
+   case EVENT_ADOPT:
+      fprintf (out, ", \"args\": {\"root\": \"%#" PRIxPTR "\","
+            " \"child\": \"%#" PRIxPTR "\"}", args[0], args[1]);
+      break;
+   case EVENT_FREE_AST:
+      fprintf (out, ", \"args\": {\"node\": \"%#" PRIxPTR "\","
+            " \"symbol\": \"%s\"}", args[0], get_yytname (args[1]));
+      break;
+   case EVENT_COMPILE:
+      fputs (", \"args\": {\"file\": \"", out);
+      for (const char* ch = (const char*) args[0]; *ch != '\0'; ++ch) {
+         if (*ch == '"' or *ch == '\\') fputc ('\\', out);
+         if ((unsigned char) *ch >= ' ') fputc (*ch, out);
+      }
+      fputs ("\"}", out);
+      break;
+   }
+   fputc ('}', out);
+}
+
+bool trace_write (const string& path) {
+   trace_categories = 0;
+   FILE* out = fopen (path.c_str(), "w");
+   if (out == NULL) {
+      syserrprintf (path.c_str());
+      clear_rings();
+      return false;
+   }
+   int pid = getpid();
+   fprintf (out, "{\"traceEvents\": [\n");
+   const char* separator = "";
+   size_t dropped = 0;
+   for (size_t index = 0; index < rings.size(); ++index) {
+      const trace_ring* thread_ring = rings[index];
+      int thread = thread_ring->thread;
+      fprintf (out, "%s{\"name\": \"thread_name\", \"ph\": \"M\","
+            " \"pid\": %d, \"tid\": %d, \"args\": {\"name\":"
+            " \"thread %d\"}}", separator, pid, thread, thread);
+      separator = ",\n";
+      size_t recorded = thread_ring->recorded;
+      size_t first = 0;
+      if (recorded > TRACE_RING_SIZE) {
+         first = recorded - TRACE_RING_SIZE;
+         dropped += first;
+      }
+      for (size_t event = first; event < recorded; ++event) {
+         fputs (separator, out);
+         write_event (out, pid, thread,
+               thread_ring->events[event % TRACE_RING_SIZE]);
+      }
+   }
+   fprintf (out, "],\n\"otherData\": {\"dropped\": %zu}}\n", dropped);
+   bool written = fclose (out) == 0;
+   if (not written) syserrprintf (path.c_str());
+   DEBUGF ('m', "trace: %zu threads, %zu events dropped\n",
+         rings.size(), dropped);
+   clear_rings();
+   return written;
+}
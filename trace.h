@@ -0,0 +1,91 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <string>
+using namespace std;
+
+#include <stdint.h>
+#include <time.h>
+
+//
+// DESCRIPTION
+//    Tracing of the compiler into a ring buffer per thread, exported
+//    as a Chrome trace, which chrome://tracing or Perfetto show as a
+//    timeline.  Events are fixed-size binary records; nothing is
+//    formatted until the export.  A TRACE statement whose category
+//    is off costs a load and a branch predicted not taken, and none
+//    at all when compiled with -DNTRACE.  When a ring is full, its
+//    oldest events are overwritten.
+//
+
+// Categories, selected with --trace.
+enum {
+   TRACE_AST = 1 << 0,        // Nodes made, adopted and freed
+   TRACE_PHASES = 1 << 1,     // Compilations and their phases
+   TRACE_ALL = TRACE_AST | TRACE_PHASES,
+};
+
+// Events and their arguments.
+enum {
+   EVENT_NEW_ASTREE,          // node, symbol, linenr
+   EVENT_ADOPT,               // root, child
+   EVENT_FREE_AST,            // node, symbol
+   EVENT_PHASE,               // phase, a span
+   EVENT_COMPILE,             // file name, a span
+   NEVENTS,
+};
+
+extern unsigned trace_categories;
+
+#ifdef NTRACE
+#define TRACE(CATEGORY,EVENT,A,B,C) /**/
+#define TRACE_SPAN(CATEGORY,EVENT,START,A) /**/
+#else
+void trace_record (int event, uintptr_t a, uintptr_t b, uintptr_t c);
+void trace_span (int event, const struct timespec& start,
+      uintptr_t a);
+#define TRACE(CATEGORY,EVENT,A,B,C) \
+        do { \
+           if (__builtin_expect (trace_categories & (CATEGORY), 0)) { \
+              trace_record (EVENT, (uintptr_t) (A), (uintptr_t) (B), \
+                    (uintptr_t) (C)); \
+           } \
+        } while (0)
+#define TRACE_SPAN(CATEGORY,EVENT,START,A) \
+        do { \
+           if (__builtin_expect (trace_categories & (CATEGORY), 0)) { \
+              trace_span (EVENT, START, (uintptr_t) (A)); \
+           } \
+        } while (0)
+#endif
+   //
+   // Record an event that happens now, or a span from start, on the
+   // monotonic clock, until now.  A file name given to EVENT_COMPILE
+   // must stay valid until the trace is written.
+   //
+
+bool trace_scan (const string& spec, string* path,
+      unsigned* categories);
+   //
+   // Parses the argument of --trace, a file name followed by the
+   // categories to trace, all by default, as in "out.json,ast".
+   // Returns false if a category is unknown.
+   //
+
+void trace_start (unsigned categories);
+   //
+   // Discards the events recorded so far and starts recording those
+   // of categories.
+   //
+
+bool trace_write (const string& path);
+   //
+   // Stops recording and writes the events of every thread to path
+   // as a Chrome trace.  Must not be called while other threads may
+   // still record events.  Returns false, after reporting why, if
+   // path could not be written.
+   //
+
+#endif
@@ -206,6 +206,8 @@ string check_call (astree* node, SymbolTable* global) {
 
    vector<string> type = global->parseSignature(global->
          lookup(ident_name, node->linenr));
+   // parseSignature reported a name that is no function.
+   if (type.empty()) return "";
    return type.front();
 }
 
@@ -376,6 +378,12 @@ string check_vardecl (astree* node, SymbolTable* types,
    string name = node->children[name_index]->lexinfo->c_str();
    string type = global->lookup(name, node->linenr);
 
+   // Only the interface of a module declares a variable it defines.
+   if (node->children.size() < 3) {
+      errprintf ("%zu: %s needs an initializer\n", node->linenr,
+            name.c_str());
+      return "";
+   }
    string expr = check_expr (node->children[2], types, global);
 
    //fprintf (stderr, "%s:%s\n", type.c_str(), expr.c_str());
@@ -459,6 +467,10 @@ string check_block (astree* node, SymbolTable* types,
 void typecheck_rec (astree* node, SymbolTable* types,
       SymbolTable* global, int depth) {
    if (node == NULL) return;
+   // The oil of a cached function was generated from the same tree
+   // and declarations, which passed then.  Interfaces were checked
+   // with their module.
+   if (oil_cached (node) or is_imported (node)) return;
 
    for (size_t child = 0; child < node->children.size();
          ++child) {
@@ -0,0 +1,71 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <assert.h>
+
+#include "auxlib.h"
+#include "workpool.h"
+
+work_pool::work_pool (const vector<size_t>& weights, int nworkers) {
+   assert (nworkers > 0);
+   vector<size_t> order;
+   for (size_t job = 0; job < weights.size(); ++job) {
+      order.push_back (job);
+   }
+   stable_sort (order.begin(), order.end(),
+         [&weights] (size_t a, size_t b) {
+            return weights[a] > weights[b];
+         });
+
+   for (int worker = 0; worker < nworkers; ++worker) {
+      queues.push_back (new job_queue());
+   }
+   for (size_t index = 0; index < order.size(); ++index) {
+      queues[index % nworkers]->jobs.push_back (order[index]);
+   }
+}
+
+work_pool::~work_pool() {
+   for (size_t worker = 0; worker < queues.size(); ++worker) {
+      delete queues[worker];
+   }
+}
+
+int work_pool::workers() {
+   return queues.size();
+}
+
+bool work_pool::next_job (int worker, size_t* job) {
+   int nworkers = queues.size();
+   // Start with our own deque, then go round the others.
+   for (int offset = 0; offset < nworkers; ++offset) {
+      job_queue* queue = queues[(worker + offset) % nworkers];
+      lock_guard<mutex> guard (queue->lock);
+      if (not queue->jobs.empty()) {
+         *job = queue->jobs.front();
+         queue->jobs.pop_front();
+         if (offset != 0) {
+            DEBUGF ('w', "worker %d stole job %zu\n", worker, *job);
+         }
+         return true;
+      }
+   }
+   return false;
+}
+
+void work_pool::run (worker_fn body, void* arg) {
+   vector<thread> threads;
+   for (int worker = 1; worker < workers(); ++worker) {
+      threads.push_back (thread (body, this, worker, arg));
+   }
+   body (this, 0, arg);
+   for (size_t index = 0; index < threads.size(); ++index) {
+      threads[index].join();
+   }
+}
@@ -0,0 +1,47 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __WORKPOOL_H__
+#define __WORKPOOL_H__
+
+#include <deque>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+//
+// DESCRIPTION
+//    A small work-stealing thread pool.  Jobs are identified by
+//    their index and sorted by decreasing weight before being dealt
+//    round robin to one deque per worker.  A worker takes jobs from
+//    the front of its own deque and, once that is empty, steals from
+//    the front of the others', so the largest remaining job is
+//    always the next one to start.
+//
+
+class work_pool {
+   struct job_queue {
+      mutex lock;
+      deque<size_t> jobs;
+   };
+
+   vector<job_queue*> queues;
+
+public:
+   typedef void (*worker_fn) (work_pool* pool, int worker, void* arg);
+
+   // Creates a pool of nworkers for jobs 0 .. weights.size() - 1.
+   work_pool (const vector<size_t>& weights, int nworkers);
+   ~work_pool();
+
+   int workers();
+
+   // Stores the next job for worker in *job.  Returns false once
+   // there is no job left anywhere.
+   bool next_job (int worker, size_t* job);
+
+   // Runs body once per worker and waits for all of them.  Worker 0
+   // runs in the calling thread.
+   void run (worker_fn body, void* arg);
+};
+
+#endif
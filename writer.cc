@@ -0,0 +1,137 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+using namespace std;
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "auxlib.h"
+#include "writer.h"
+
+// Buffers that may wait in the queue before front ends block.
+static const size_t WRITER_QUEUE_DEPTH = 16;
+
+struct write_job {
+   string path;
+   char* data;
+   size_t size;
+   compile_context* ctx;
+};
+
+struct writer_state {
+   mutex lock;
+   condition_variable changed;
+   deque<write_job> queue;
+   long submitted;
+   long completed;
+   bool started;
+   writer_stats stats;
+   writer_state(): submitted (0), completed (0), started (false),
+         stats() {}
+};
+
+// Never destroyed, as the detached thread still waits on it while
+// the process exits.
+static writer_state* state = new writer_state();
+
+static double seconds_since (const struct timespec& start) {
+   struct timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+   return (now.tv_sec - start.tv_sec)
+        + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+ * Writes one buffer.  Returns 0, or the errno of the failure.
+ */
+static int write_out (const write_job& job) {
+   int fd = open (job.path.c_str(),
+         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+   if (fd < 0) return errno;
+   const char* data = job.data;
+   size_t size = job.size;
+   while (size > 0) {
+      ssize_t written = write (fd, data, size);
+      if (written < 0) {
+         if (errno == EINTR) continue;
+         int error = errno;
+         close (fd);
+         return error;
+      }
+      data += written;
+      size -= written;
+   }
+   return close (fd) == 0 ? 0 : errno;
+}
+
+static void writer_main (void) {
+   unique_lock<mutex> guard (state->lock);
+   for (;;) {
+      while (state->queue.empty()) state->changed.wait (guard);
+      write_job job = state->queue.front();
+      state->queue.pop_front();
+      state->changed.notify_all();
+      guard.unlock();
+
+      struct timespec start;
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      int error = write_out (job);
+      free (job.data);
+      double seconds = seconds_since (start);
+
+      guard.lock();
+      state->stats.write_seconds += seconds;
+      if (error != 0 and job.ctx->write_error.empty()) {
+         job.ctx->write_error = job.path + ": " + strerror (error);
+      }
+      ++state->completed;
+      state->changed.notify_all();
+   }
+}
+
+long writer_submit (const string& path, char* data, size_t size,
+      compile_context* ctx) {
+   unique_lock<mutex> guard (state->lock);
+   if (not state->started) {
+      thread (writer_main).detach();
+      state->started = true;
+   }
+   if (state->queue.size() >= WRITER_QUEUE_DEPTH) {
+      struct timespec start;
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      while (state->queue.size() >= WRITER_QUEUE_DEPTH) {
+         state->changed.wait (guard);
+      }
+      state->stats.wait_seconds += seconds_since (start);
+   }
+   write_job job = {path, data, size, ctx};
+   state->queue.push_back (job);
+   ++state->stats.buffers;
+   state->stats.bytes += size;
+   if (state->stats.max_depth < state->queue.size()) {
+      state->stats.max_depth = state->queue.size();
+   }
+   state->changed.notify_all();
+   DEBUGF ('w', "queued %s, %zu bytes, depth %zu\n", path.c_str(),
+         size, state->queue.size());
+   return ++state->submitted;
+}
+
+void writer_wait (long ticket) {
+   unique_lock<mutex> guard (state->lock);
+   while (state->completed < ticket) state->changed.wait (guard);
+}
+
+writer_stats writer_get_stats (void) {
+   lock_guard<mutex> guard (state->lock);
+   return state->stats;
+}
@@ -0,0 +1,50 @@
+// Paul Scherer, pscherer@ucsc.edu
+
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+#include <string>
+using namespace std;
+
+#include <stddef.h>
+
+#include "context.h"
+
+//
+// DESCRIPTION
+//    Background writer for the dumps of a compilation.  The front
+//    end formats a dump into memory and queues the buffer; a single
+//    thread shared by all compilations writes it out with one large
+//    write(2) while the front end goes on with type checking and
+//    code generation.  The queue is bounded, so a front end that
+//    outruns the disk waits for room instead of piling up buffers.
+//
+
+struct writer_stats {
+   long buffers;              // Buffers queued
+   size_t bytes;              // Bytes in them
+   size_t max_depth;          // Most buffers queued at once
+   double write_seconds;      // Writer thread blocked in the kernel
+   double wait_seconds;       // Front ends blocked on a full queue
+};
+
+long writer_submit (const string& path, char* data, size_t size,
+      compile_context* ctx);
+   //
+   // Queues data, which must come from malloc, to be written to
+   // path and freed.  If the write fails, the error is stored in
+   // ctx->write_error.  Returns a ticket for writer_wait.
+   //
+
+void writer_wait (long ticket);
+   //
+   // Waits until the buffer with ticket and every buffer queued
+   // before it have been written.
+   //
+
+writer_stats writer_get_stats (void);
+   //
+   // Returns the statistics of the writer since the process started.
+   //
+
+#endif